@@ -0,0 +1,484 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// The aptinfo library. Nothing in here prints or touches global state, so
+// every function may be called concurrently from any number of threads.
+
+#pragma once
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+
+#include <objbase.h>
+#include <windows.h>
+
+namespace aptinfo {
+
+extern const CLSID CLSID_FreeThreadedMarshaler;
+extern const CLSID CLSID_UniversalMarshaler;
+
+struct GuidHash final {
+  size_t operator()(REFGUID aGuid) const {
+    uint64_t halves[2];
+    static_assert(sizeof(halves) == sizeof(GUID));
+    memcpy(halves, &aGuid, sizeof(halves));
+    return std::hash<uint64_t>()(halves[0] ^ halves[1]);
+  }
+};
+
+enum class ClassType {
+  Server,
+  Proxy,
+};
+
+enum class ThreadingModel {
+  STA,
+  MTA,
+  Both,
+  Neutral,
+};
+
+enum class Provenance {
+  Registry,
+  FreeThreadedMarshaler,
+  Manifest, // <-- unsupported by us (no public API), but still possible
+  AgileObject,
+};
+
+// Each step that a query performs is recorded, in order, along with its
+// result. The steps are grouped by the phase of the query that performs them.
+enum class DiagnosticStep {
+  // Emulation (LSTATUS)
+  ResolveTreatAs,
+  // In-process server (LSTATUS)
+  ReadThreadingModel,
+  ReadServerPath,
+  // Object capabilities (HRESULT)
+  EnterApartment,
+  CreateInstance,
+  QueryAgileObject,
+  QueryMarshal,
+  GetUnmarshalClass,
+  // DLL surrogate (LSTATUS)
+  ReadAppID,
+  ReadDllSurrogate,
+  // Local server
+  OpenLocalServer,           // LSTATUS
+  EnterClassObjectApartment, // HRESULT
+  GetClassObject,            // HRESULT
+  // Proxy/stub
+  ReadProxyStubClsid,      // LSTATUS
+  ParseProxyStubClsid,     // HRESULT
+  ReadProxyThreadingModel, // LSTATUS
+  ReadProxyServerPath,     // LSTATUS
+};
+
+struct Diagnostic final {
+  DiagnosticStep mStep;
+  // Either an LSTATUS or an HRESULT, depending on mStep.
+  LONG mCode;
+};
+
+using Diagnostics = std::vector<Diagnostic>;
+
+class ComClassThreadInfo final {
+public:
+  constexpr ComClassThreadInfo(const ThreadingModel aThdModel,
+                               const Provenance aProvenance)
+      : mThreadingModel7(aThdModel), mProvenance7(aProvenance),
+        mThreadingModel8(aThdModel), mProvenance8(aProvenance) {}
+
+  constexpr ComClassThreadInfo(const ThreadingModel aThdModel7,
+                               const Provenance aProvenance7,
+                               const ThreadingModel aThdModel8,
+                               const Provenance aProvenance8)
+      : mThreadingModel7(aThdModel7), mProvenance7(aProvenance7),
+        mThreadingModel8(aThdModel8), mProvenance8(aProvenance8) {}
+
+  std::wstring GetDescription(const ClassType aClassType,
+                              const bool aDescriptive) const;
+
+  // Instantiates the class to look for IAgileObject and the free-threaded
+  // marshaler. This happens on a long-lived thread of the library's own, in
+  // an apartment matching the class's threading model, so the caller's thread
+  // is never initialized for COM. Concurrent calls take turns on that thread.
+  // Each step is appended to aDiagnostics.
+  ComClassThreadInfo
+  CheckObjectCapabilities(REFCLSID aClsid, const std::optional<IID> &aOptIid,
+                          Diagnostics &aDiagnostics) const;
+
+  ThreadingModel GetThreadingModel7() const { return mThreadingModel7; }
+  Provenance GetProvenance7() const { return mProvenance7; }
+  ThreadingModel GetThreadingModel8() const { return mThreadingModel8; }
+  Provenance GetProvenance8() const { return mProvenance8; }
+
+  ComClassThreadInfo(const ComClassThreadInfo &) = default;
+  ComClassThreadInfo(ComClassThreadInfo &&) = default;
+  ComClassThreadInfo &operator=(const ComClassThreadInfo &) = delete;
+  ComClassThreadInfo &operator=(ComClassThreadInfo &&) = delete;
+
+private:
+  // The body of CheckObjectCapabilities, once inside the apartment
+  ComClassThreadInfo
+  CheckObjectCapabilitiesInApartment(REFCLSID aClsid,
+                                     const std::optional<IID> &aOptIid,
+                                     Diagnostics &aDiagnostics) const;
+
+  static std::wstring
+  GetThreadingModelDescription(const ThreadingModel aThdModel,
+                               const bool aDescriptive);
+  static const std::wstring_view
+  GetProvenanceDescription(const Provenance aProvenance);
+
+private:
+  const ThreadingModel mThreadingModel7;
+  const Provenance mProvenance7;
+  const ThreadingModel mThreadingModel8;
+  const Provenance mProvenance8;
+};
+
+class ClassStore;
+class Hive;
+
+// Resolves ProgIDs to CLSIDs (and vice versa) using a single pass over a
+// classes root. ::CLSIDFromProgID walks the registry on every call, which is
+// wasteful once we need to resolve more than a handful of ProgIDs.
+class ProgIDIndex final {
+public:
+  static std::variant<ProgIDIndex, LSTATUS> Build(const ClassStore &aStore);
+
+  std::optional<CLSID> Lookup(const std::wstring_view &aProgID) const;
+  std::optional<std::wstring_view> GetProgID(REFCLSID aClsid) const;
+
+  ProgIDIndex(ProgIDIndex &&) = default;
+  ProgIDIndex(const ProgIDIndex &) = delete;
+  ProgIDIndex &operator=(const ProgIDIndex &) = delete;
+  ProgIDIndex &operator=(ProgIDIndex &&) = delete;
+
+private:
+  ProgIDIndex() = default;
+
+  void AddReverse(REFCLSID aClsid, const std::wstring &aProgID,
+                  const bool aIsVersionIndependent);
+
+private:
+  // Keys are case-folded since the registry is case-insensitive.
+  std::unordered_map<std::wstring, CLSID> mClsids;
+  // Values retain their original case for display purposes.
+  std::unordered_map<CLSID, std::wstring, GuidHash> mProgIDs;
+};
+
+// A handle to a set of class registrations: either the live HKEY_CLASSES_ROOT
+// or the classes key of an offline hive. Every subkey path taken by the
+// methods below is relative to the classes root.
+class ClassStore final {
+public:
+  static std::unique_ptr<ClassStore> OpenSystem();
+
+  // Loads aHivePath privately to this process. Both SOFTWARE hives (whose
+  // classes live under "Classes") and UsrClass.dat hives are accepted.
+  static std::variant<std::unique_ptr<ClassStore>, LSTATUS>
+  OpenHive(const wchar_t *aHivePath);
+
+  // Reads a copy of a hive file directly instead of loading it into the
+  // registry, replaying any .LOG1/.LOG2 transaction logs beside it in memory.
+  // Neither the hive nor its logs are ever written to. REG_EXPAND_SZ values
+  // are returned unexpanded.
+  static std::variant<std::unique_ptr<ClassStore>, LSTATUS>
+  OpenHiveCopy(const wchar_t *aHivePath);
+
+  // Opens many hive copies as OpenHiveCopy does, reading several hives and
+  // their logs at once with batched I/O while those already read are passed
+  // to aOnStore, along with their index within aHivePaths. aOnStore is invoked
+  // concurrently from worker threads, in whatever order the reads complete.
+  // At most aMaxInFlight hives are held in memory at any given time.
+  static void OpenHiveCopies(
+      const std::vector<std::wstring> &aHivePaths,
+      const unsigned int aMaxInFlight,
+      const std::function<void(
+          size_t, std::variant<std::unique_ptr<ClassStore>, LSTATUS> &&)>
+          &aOnStore);
+
+  ~ClassStore();
+
+  // Objects may only be instantiated from the live registry.
+  bool IsSystem() const { return !mHive && !mHiveCopy; }
+
+  // Only hive copies have their logs replayed; zero for everything else.
+  uint32_t GetNumReplayedLogEntries() const;
+
+  // A null aValueName refers to the key's default value.
+  LSTATUS GetString(const std::wstring &aSubKey, const wchar_t *aValueName,
+                    std::wstring &aValue) const;
+  LSTATUS HasValue(const std::wstring &aSubKey,
+                   const wchar_t *aValueName) const;
+  LSTATUS HasKey(const std::wstring &aSubKey) const;
+  LSTATUS EnumSubKeys(
+      const std::wstring &aSubKey,
+      const std::function<void(const std::wstring_view &)> &aCallback) const;
+
+  // Built on first use and shared by every subsequent caller.
+  std::variant<const ProgIDIndex *, LSTATUS> GetProgIDIndex() const;
+
+  ClassStore(const ClassStore &) = delete;
+  ClassStore(ClassStore &&) = delete;
+  ClassStore &operator=(const ClassStore &) = delete;
+  ClassStore &operator=(ClassStore &&) = delete;
+
+private:
+  ClassStore(HKEY aHive, HKEY aRoot);
+  ClassStore(std::unique_ptr<Hive> &&aHiveCopy, const uint32_t aHiveCopyRoot);
+
+  static std::variant<std::unique_ptr<ClassStore>, LSTATUS>
+  FromHiveCopy(std::unique_ptr<Hive> &&aHiveCopy);
+
+private:
+  // Null for the live registry and for hive copies
+  const HKEY mHive;
+  const HKEY mRoot;
+  // Only set for hive copies, in which case the above are null.
+  const std::unique_ptr<Hive> mHiveCopy;
+  const uint32_t mHiveCopyRoot;
+  mutable std::once_flag mProgIDIndexOnce;
+  mutable std::optional<std::variant<ProgIDIndex, LSTATUS>> mProgIDIndex;
+};
+
+enum class QueryMode {
+  // Instantiates the class to check its capabilities (live registry only).
+  Full,
+  // Never loads any code; only registry data is consulted.
+  RegistryOnly,
+};
+
+enum class ServerKind {
+  Unregistered,
+  InprocServer,
+  LocalServer,
+};
+
+struct SurrogateInfo final {
+  std::wstring mAppID;
+  // Empty when the system default surrogate (dllhost.exe) is used.
+  std::wstring mSurrogatePath;
+};
+
+struct ProxyInfo final {
+  bool IsUniversalMarshaler() const {
+    return mProxyStubClsid &&
+           mProxyStubClsid.value() == CLSID_UniversalMarshaler;
+  }
+
+  std::optional<CLSID> mProxyStubClsid;
+  std::wstring mServerPath;
+  std::optional<ComClassThreadInfo> mThreadInfo;
+};
+
+struct ClassReport final {
+  explicit ClassReport(REFCLSID aClsid) : mClsid(aClsid) {}
+
+  const CLSID mClsid;
+  // The class that is actually activated, when mClsid is emulated via
+  // TreatAs. Everything below describes this class instead of mClsid.
+  std::optional<CLSID> mTreatAs;
+  // Only populated by Scan.
+  std::wstring mProgID;
+  ServerKind mServerKind = ServerKind::Unregistered;
+  // Only present for in-process servers.
+  std::optional<ComClassThreadInfo> mThreadInfo;
+  std::wstring mServerPath;
+  // Only present for in-process servers with a DllSurrogate.
+  std::optional<SurrogateInfo> mSurrogate;
+  // Only present when an IID was supplied and the class may be
+  // instantiated out-of-process.
+  std::optional<ProxyInfo> mProxy;
+  Diagnostics mDiagnostics;
+
+  // The result of the most recent occurrence of aStep, if it was performed.
+  std::optional<LONG> GetResult(const DiagnosticStep aStep) const;
+};
+
+// A map that any number of threads may read and fill concurrently. Entries
+// are never replaced once inserted.
+template <typename KeyT, typename ValueT, typename HashT = std::hash<KeyT>>
+class MemoTable final {
+public:
+  MemoTable() = default;
+
+  // Computes each key's value exactly once: the first caller to ask for aKey
+  // runs aCompute, without the lock held, while any others that ask for it in
+  // the meantime wait for that result. aCompute may consult the table for
+  // other keys, but must not ask for aKey itself. Should aCompute throw, so
+  // does every request for aKey.
+  template <typename ComputeT>
+  ValueT GetOrCompute(const KeyT &aKey, ComputeT &&aCompute) {
+    std::shared_future<ValueT> value;
+    {
+      std::shared_lock<std::shared_mutex> lock(mMutex);
+      auto itr = mTable.find(aKey);
+      if (itr != mTable.end()) {
+        value = itr->second;
+      }
+    }
+
+    if (!value.valid()) {
+      std::promise<ValueT> promise;
+      bool inserted;
+      {
+        std::lock_guard<std::shared_mutex> lock(mMutex);
+        auto result = mTable.emplace(aKey, promise.get_future());
+        value = result.first->second;
+        inserted = result.second;
+      }
+
+      // Otherwise another thread got here first and is computing it.
+      if (inserted) {
+        try {
+          promise.set_value(aCompute());
+        } catch (...) {
+          // Those waiting for this key, and those who ask for it later, see
+          // the same exception rather than a broken promise.
+          promise.set_exception(std::current_exception());
+          throw;
+        }
+      }
+    }
+
+    return value.get();
+  }
+
+  MemoTable(const MemoTable &) = delete;
+  MemoTable(MemoTable &&) = delete;
+  MemoTable &operator=(const MemoTable &) = delete;
+  MemoTable &operator=(MemoTable &&) = delete;
+
+private:
+  mutable std::shared_mutex mMutex;
+  std::unordered_map<KeyT, std::shared_future<ValueT>, HashT> mTable;
+};
+
+// Resolves the registry nodes that many classes tend to share, and memoizes
+// each one so that a bulk query only ever reads it once: TreatAs emulation,
+// AppID surrogates, and interface proxies. A resolver is a snapshot of its
+// store, so create one per bulk operation. Resolvers may be shared by any
+// number of threads.
+class ClassResolver final {
+public:
+  explicit ClassResolver(const ClassStore &aStore) : mStore(aStore) {}
+
+  const ClassStore &GetStore() const { return mStore; }
+
+  // Follows TreatAs (or AutoTreatAs, when a class has no TreatAs) until
+  // reaching a class that is not emulated, which is returned. Fails with
+  // ERROR_CIRCULAR_DEPENDENCY when the chain loops back on itself.
+  std::variant<CLSID, LSTATUS> ResolveTreatAs(REFCLSID aClsid) const;
+
+  std::optional<SurrogateInfo>
+  ResolveSurrogate(const std::wstring_view &aAppID,
+                   Diagnostics &aDiagnostics) const;
+
+  ProxyInfo ResolveProxy(REFIID aIid, Diagnostics &aDiagnostics) const;
+
+  ClassResolver(const ClassResolver &) = delete;
+  ClassResolver(ClassResolver &&) = delete;
+  ClassResolver &operator=(const ClassResolver &) = delete;
+  ClassResolver &operator=(ClassResolver &&) = delete;
+
+private:
+  std::variant<std::optional<CLSID>, LSTATUS>
+  ReadTreatAs(REFCLSID aClsid) const;
+
+private:
+  const ClassStore &mStore;
+  // Every class that we have seen, mapped to the class that it directly
+  // names as its emulator, if any
+  mutable MemoTable<CLSID, std::variant<std::optional<CLSID>, LSTATUS>,
+                    GuidHash>
+      mTreatAs;
+  // Keyed by case-folded AppID; values are DllSurrogate paths.
+  mutable MemoTable<std::wstring, std::variant<std::wstring, LSTATUS>>
+      mSurrogates;
+  // Proxies are stored along with the diagnostics from resolving them.
+  mutable MemoTable<IID, std::pair<ProxyInfo, Diagnostics>, GuidHash>
+      mProxies;
+};
+
+ClassReport QueryClass(const ClassStore &aStore, REFCLSID aClsid,
+                       const std::optional<IID> &aOptIid,
+                       const QueryMode aMode = QueryMode::Full);
+
+// As above, but shares aResolver's memoized results with other queries.
+ClassReport QueryClass(const ClassResolver &aResolver, REFCLSID aClsid,
+                       const std::optional<IID> &aOptIid,
+                       const QueryMode aMode = QueryMode::Full);
+
+// Resolves the proxy/stub class for aIid and its threading model.
+ProxyInfo QueryProxy(const ClassStore &aStore, REFIID aIid,
+                     Diagnostics &aDiagnostics);
+
+// Scan filters are evaluated while traversing the CLSID key so that classes
+// which cannot match are skipped before we classify them. The CLSID range
+// applies to the class being visited, but value and server path filters
+// apply to the class that COM would actually instantiate: for classes that
+// are emulated via TreatAs, that is the emulating class, which is also the
+// one that the match's report describes.
+struct ValueFilter final {
+  // Relative to the effective class's CLSID key; empty for the key itself.
+  std::wstring mSubKey;
+  std::wstring mValueName;
+  bool mPresent;
+};
+
+struct ScanFilters final {
+  // Treated as a prefix unless it contains * or ? wildcards.
+  void SetServerPathPattern(const std::wstring_view &aPattern);
+  void SetClsidRange(REFCLSID aFirst, REFCLSID aLast);
+
+  bool IsEmpty() const {
+    return mValueFilters.empty() && !mServerPathPattern && !mClsidRange;
+  }
+
+  std::vector<ValueFilter> mValueFilters;
+  // Case-folded glob pattern
+  std::optional<std::wstring> mServerPathPattern;
+  // Both ends in registry format
+  std::optional<std::pair<std::wstring, std::wstring>> mClsidRange;
+};
+
+struct ScanCounters final {
+  DWORD mVisited = 0;
+  // Subkeys of CLSID whose names are not GUIDs
+  DWORD mSkippedNonClsid = 0;
+  DWORD mPrunedByRange = 0;
+  // Classes in range that have TreatAs or AutoTreatAs subkeys, whose
+  // emulation is resolved before applying the value and path filters
+  DWORD mFollowedTreatAs = 0;
+  DWORD mPrunedByValue = 0;
+  DWORD mPrunedByPath = 0;
+  DWORD mMatched = 0;
+};
+
+// Invokes aOnMatch with a registry-only report for every class that passes
+// aFilters. Matches are named via aStore's ProgIDIndex, so failing to build
+// that index fails the scan.
+LSTATUS Scan(const ClassStore &aStore, const ScanFilters &aFilters,
+             const std::optional<IID> &aOptIid,
+             const std::function<void(ClassReport &&)> &aOnMatch,
+             ScanCounters &aCounters);
+
+} // namespace aptinfo
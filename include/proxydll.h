@@ -0,0 +1,103 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Static analysis of MIDL-generated proxy/stub DLLs. This reads the DLL's
+// ProxyFileInfo tables directly, so it neither requires the DLL to be
+// registered nor loads it, and it has no Windows dependencies.
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace aptinfo {
+
+// Layout-compatible with the Windows GUID structure.
+struct RawGuid final {
+  uint32_t mData1;
+  uint16_t mData2;
+  uint16_t mData3;
+  uint8_t mData4[8];
+
+  bool operator==(const RawGuid &aOther) const {
+    return !memcmp(this, &aOther, sizeof(RawGuid));
+  }
+};
+
+static_assert(sizeof(RawGuid) == 16);
+
+struct RawGuidHash final {
+  size_t operator()(const RawGuid &aGuid) const {
+    uint64_t halves[2];
+    memcpy(halves, &aGuid, sizeof(halves));
+    return std::hash<uint64_t>()(halves[0] ^ halves[1]);
+  }
+};
+
+struct ProxiedInterface final {
+  RawGuid mIid;
+  // As emitted by MIDL into the DLL's interface name table
+  std::string mName;
+};
+
+struct ProxyDllInfo final {
+  std::filesystem::path mPath;
+  std::vector<ProxiedInterface> mInterfaces;
+};
+
+enum class ProxyDllStatus {
+  CannotOpen,
+  NotPortableExecutable,
+  NoProxyFileInfo,
+};
+
+// Maps aPath and lists every interface that its ProxyFileInfo tables can
+// marshal.
+std::variant<ProxyDllInfo, ProxyDllStatus>
+AnalyzeProxyDll(const std::filesystem::path &aPath);
+
+// Analyzes every DLL in aDir in parallel, using aNumThreads workers (or one
+// per hardware thread when zero). DLLs without any ProxyFileInfo tables are
+// omitted from the result.
+std::variant<std::vector<ProxyDllInfo>, ProxyDllStatus>
+AnalyzeProxyDllDirectory(const std::filesystem::path &aDir,
+                         unsigned int aNumThreads = 0);
+
+// Maps IIDs to the analyzed DLLs that can marshal them, for merging with the
+// registrations found in a ClassStore.
+class ProxyDllIndex final {
+public:
+  explicit ProxyDllIndex(std::vector<ProxyDllInfo> &&aDlls);
+
+  void Lookup(const RawGuid &aIid,
+              const std::function<void(const ProxyDllInfo &,
+                                       const ProxiedInterface &)> &aCallback)
+      const;
+
+  size_t GetNumDlls() const { return mDlls.size(); }
+  size_t GetNumInterfaces() const { return mByIid.size(); }
+
+  ProxyDllIndex(ProxyDllIndex &&) = default;
+  ProxyDllIndex(const ProxyDllIndex &) = delete;
+  ProxyDllIndex &operator=(const ProxyDllIndex &) = delete;
+  ProxyDllIndex &operator=(ProxyDllIndex &&) = delete;
+
+private:
+  std::vector<ProxyDllInfo> mDlls;
+  // Values are (DLL, interface) indices into mDlls.
+  std::unordered_multimap<RawGuid, std::pair<size_t, size_t>, RawGuidHash>
+      mByIid;
+};
+
+} // namespace aptinfo
@@ -0,0 +1,83 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <windows.h>
+
+template <typename T, size_t N>
+static inline constexpr size_t ArrayLength(T (&aArr)[N]) {
+  return N;
+}
+
+template <typename ExitFnT> class ScopeExit final {
+public:
+  explicit ScopeExit(ExitFnT &&aExitFn)
+      : mExitFn(std::forward<ExitFnT>(aExitFn)), mExecute(true) {}
+
+  ScopeExit(ScopeExit &&aRhs)
+      : mExitFn(std::move(aRhs)), mExecute(aRhs.mExecute) {
+    aRhs.release();
+  }
+
+  ~ScopeExit() {
+    if (!mExecute) {
+      return;
+    }
+
+    mExitFn();
+  }
+
+  void release() { mExecute = false; }
+
+  ScopeExit(ScopeExit const &) = delete;
+  ScopeExit &operator=(ScopeExit const &) = delete;
+  ScopeExit &operator=(ScopeExit &&) = delete;
+
+private:
+  ExitFnT mExitFn;
+  bool mExecute;
+};
+
+template <typename ExitFnT>
+[[nodiscard]] ScopeExit<ExitFnT> MakeScopeExit(ExitFnT &&aExitFn) {
+  return ScopeExit<ExitFnT>(std::forward<ExitFnT>(aExitFn));
+}
+
+static inline std::wstring_view BufToView(const wchar_t *aBuf,
+                                          const size_t aNumBytesInclNul) {
+  if (aNumBytesInclNul < (2 * sizeof(wchar_t))) {
+    return std::wstring_view();
+  }
+
+  return std::wstring_view(aBuf,
+                           ((aNumBytesInclNul + 1) / sizeof(wchar_t)) - 1);
+}
+
+template <size_t N>
+static inline std::wstring_view BufToView(const wchar_t (&aBuf)[N]) {
+  return std::wstring_view(aBuf, N - 1);
+}
+
+// Registry names are case-insensitive, so fold them before comparing.
+static inline std::wstring FoldCase(const std::wstring_view &aStr) {
+  std::wstring result(aStr.size(), L'\0');
+  if (!result.empty()) {
+    ::LCMapStringEx(LOCALE_NAME_INVARIANT, LCMAP_UPPERCASE, aStr.data(),
+                    static_cast<int>(aStr.size()), result.data(),
+                    static_cast<int>(result.size()), nullptr, nullptr, 0);
+  }
+
+  return result;
+}
+
+static constexpr int kGuidLenWithBracesInclNul = 39;
+static constexpr int kGuidLenWithBracesExclNul = kGuidLenWithBracesInclNul - 1;
+static constexpr DWORD kMaxKeyNameLen = 255;
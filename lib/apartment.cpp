@@ -0,0 +1,81 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "aptinfo.h"
+
+#include "apartment.h"
+
+namespace aptinfo {
+
+ApartmentThread &ApartmentThread::Get(const ThreadingModel aThdModel) {
+  // Each is started on first use, and joined when the process exits.
+  if (aThdModel == ThreadingModel::STA) {
+    static ApartmentThread sSta(ThreadingModel::STA);
+    return sSta;
+  }
+
+  static ApartmentThread sMta(ThreadingModel::MTA);
+  return sMta;
+}
+
+ApartmentThread::ApartmentThread(const ThreadingModel aThdModel)
+    : mApartment(nullptr), mShutdown(false) {
+  // Started last, once everything that it touches has been initialized.
+  mThread = std::thread([this, aThdModel]() { Work(aThdModel); });
+}
+
+ApartmentThread::~ApartmentThread() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mShutdown = true;
+  }
+
+  mWorkAvailable.notify_one();
+  mThread.join();
+}
+
+void ApartmentThread::Work(const ThreadingModel aThdModel) {
+  Apartment apt(aThdModel);
+
+  std::unique_lock<std::mutex> lock(mMutex);
+  mApartment = &apt;
+  while (true) {
+    mWorkAvailable.wait(lock,
+                        [this]() { return mShutdown || !mQueue.empty(); });
+    if (mQueue.empty()) {
+      break;
+    }
+
+    WorkItem *item = mQueue.front();
+    mQueue.pop_front();
+
+    lock.unlock();
+    (*item->mWork)(apt);
+    lock.lock();
+
+    item->mDone = true;
+    mWorkDone.notify_all();
+  }
+
+  mApartment = nullptr;
+}
+
+void ApartmentThread::Run(const WorkT &aWork) {
+  if (std::this_thread::get_id() == mThread.get_id()) {
+    // Queueing would deadlock, and we are already in the right apartment.
+    aWork(*mApartment);
+    return;
+  }
+
+  WorkItem item{&aWork, false};
+
+  std::unique_lock<std::mutex> lock(mMutex);
+  mQueue.push_back(&item);
+  mWorkAvailable.notify_one();
+  mWorkDone.wait(lock, [&item]() { return item.mDone; });
+}
+
+} // namespace aptinfo
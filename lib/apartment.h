@@ -0,0 +1,99 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "aptinfo.h"
+
+namespace aptinfo {
+
+class Apartment final {
+public:
+  explicit Apartment(const ThreadingModel aThdModel)
+      : mHr(::CoInitializeEx(nullptr, (aThdModel == ThreadingModel::STA)
+                                          ? COINIT_APARTMENTTHREADED
+                                          : COINIT_MULTITHREADED)) {}
+
+  ~Apartment() {
+    if (FAILED(mHr)) {
+      return;
+    }
+
+    ::CoUninitialize();
+  }
+
+  explicit operator bool() const { return SUCCEEDED(mHr); }
+  HRESULT GetHResult() const { return mHr; }
+
+  Apartment(const Apartment &) = delete;
+  Apartment(Apartment &&) = delete;
+  Apartment &operator=(const Apartment &) = delete;
+  Apartment &operator=(Apartment &&) = delete;
+
+private:
+  const HRESULT mHr;
+};
+
+// A thread owned by the library that enters an apartment once and then stays
+// in it for the life of the process, so that queries need neither create a
+// thread nor initialize COM. The library never initializes COM on its
+// callers' threads, since they may already belong to an apartment of the
+// other type. Work items run one at a time, and each must release every COM
+// object that it creates before returning, since nothing pumps messages on
+// the thread between items.
+class ApartmentThread final {
+public:
+  using WorkT = std::function<void(const Apartment &)>;
+
+  // The thread for the apartment that aThdModel requires: an STA for
+  // ThreadingModel::STA, and the MTA for everything else.
+  static ApartmentThread &Get(const ThreadingModel aThdModel);
+
+  ~ApartmentThread();
+
+  // Runs aWork on this thread and waits for it to finish. aWork receives the
+  // apartment, which it must check before using COM, since entering it may
+  // have failed. Work that is already running on this thread runs inline.
+  void Run(const WorkT &aWork);
+
+  ApartmentThread(const ApartmentThread &) = delete;
+  ApartmentThread(ApartmentThread &&) = delete;
+  ApartmentThread &operator=(const ApartmentThread &) = delete;
+  ApartmentThread &operator=(ApartmentThread &&) = delete;
+
+private:
+  struct WorkItem final {
+    const WorkT *mWork;
+    bool mDone;
+  };
+
+  explicit ApartmentThread(const ThreadingModel aThdModel);
+
+  void Work(const ThreadingModel aThdModel);
+
+private:
+  std::mutex mMutex;
+  std::condition_variable mWorkAvailable;
+  std::condition_variable mWorkDone;
+  std::deque<WorkItem *> mQueue;
+  // Only valid while the thread is running
+  const Apartment *mApartment;
+  bool mShutdown;
+  std::thread mThread;
+};
+
+inline void RunInApartment(const ThreadingModel aThdModel,
+                           const ApartmentThread::WorkT &aWork) {
+  ApartmentThread::Get(aThdModel).Run(aWork);
+}
+
+} // namespace aptinfo
@@ -0,0 +1,598 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "batchreader.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define APTINFO_HAVE_IO_URING
+#include <unordered_map>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif // defined(__linux__) && __has_include(<linux/io_uring.h>)
+
+namespace aptinfo {
+
+namespace {
+
+// Performs ordinary blocking reads on a pool of threads. The storage sees as
+// many concurrent requests as there are threads.
+class ThreadPoolReader final : public FileBatchReader {
+public:
+  explicit ThreadPoolReader(const unsigned int aNumThreads);
+  ~ThreadPoolReader() override;
+
+  void Submit(const uint64_t aTag,
+              const std::filesystem::path &aPath) override;
+  std::optional<FileReadResult> WaitForCompletion() override;
+  const char *GetName() const override { return "thread pool"; }
+
+  ThreadPoolReader(const ThreadPoolReader &) = delete;
+  ThreadPoolReader(ThreadPoolReader &&) = delete;
+  ThreadPoolReader &operator=(const ThreadPoolReader &) = delete;
+  ThreadPoolReader &operator=(ThreadPoolReader &&) = delete;
+
+private:
+  static std::optional<std::vector<uint8_t>>
+  ReadFile(const std::filesystem::path &aPath);
+
+  void Work();
+
+private:
+  std::mutex mMutex;
+  std::condition_variable mWorkAvailable;
+  std::condition_variable mResultAvailable;
+  std::deque<std::pair<uint64_t, std::filesystem::path>> mWork;
+  std::deque<FileReadResult> mResults;
+  size_t mNumOutstanding;
+  bool mShutdown;
+  std::vector<std::thread> mThreads;
+};
+
+} // anonymous namespace
+
+ThreadPoolReader::ThreadPoolReader(const unsigned int aNumThreads)
+    : mNumOutstanding(0), mShutdown(false) {
+  for (unsigned int i = 0; i < aNumThreads; ++i) {
+    mThreads.emplace_back([this]() { Work(); });
+  }
+}
+
+ThreadPoolReader::~ThreadPoolReader() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mShutdown = true;
+  }
+
+  mWorkAvailable.notify_all();
+  for (std::thread &thread : mThreads) {
+    thread.join();
+  }
+}
+
+std::optional<std::vector<uint8_t>>
+ThreadPoolReader::ReadFile(const std::filesystem::path &aPath) {
+  std::ifstream file(aPath, std::ios::binary);
+  std::error_code ec;
+  const uintmax_t size = std::filesystem::file_size(aPath, ec);
+  if (!file || ec || size > SIZE_MAX) {
+    return std::nullopt;
+  }
+
+  std::vector<uint8_t> data(static_cast<size_t>(size));
+  if (!file.read(reinterpret_cast<char *>(data.data()),
+                 static_cast<std::streamsize>(data.size()))) {
+    return std::nullopt;
+  }
+
+  return data;
+}
+
+void ThreadPoolReader::Work() {
+  std::unique_lock<std::mutex> lock(mMutex);
+  while (true) {
+    mWorkAvailable.wait(lock, [this]() { return mShutdown || !mWork.empty(); });
+    if (mShutdown) {
+      return;
+    }
+
+    std::pair<uint64_t, std::filesystem::path> work =
+        std::move(mWork.front());
+    mWork.pop_front();
+
+    lock.unlock();
+    FileReadResult result{work.first, ReadFile(work.second)};
+    lock.lock();
+
+    mResults.push_back(std::move(result));
+    mResultAvailable.notify_one();
+  }
+}
+
+void ThreadPoolReader::Submit(const uint64_t aTag,
+                              const std::filesystem::path &aPath) {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mWork.emplace_back(aTag, aPath);
+    ++mNumOutstanding;
+  }
+
+  mWorkAvailable.notify_one();
+}
+
+std::optional<FileReadResult> ThreadPoolReader::WaitForCompletion() {
+  std::unique_lock<std::mutex> lock(mMutex);
+  if (!mNumOutstanding) {
+    return std::nullopt;
+  }
+
+  mResultAvailable.wait(lock, [this]() { return !mResults.empty(); });
+
+  FileReadResult result = std::move(mResults.front());
+  mResults.pop_front();
+  --mNumOutstanding;
+  return result;
+}
+
+#if defined(APTINFO_HAVE_IO_URING)
+
+namespace {
+
+// Splits every file into large reads and keeps the ring full of them, so
+// that a single thread can have aQueueDepth requests outstanding across any
+// number of files. We drive the ring through the raw system calls rather than
+// liburing to avoid the extra dependency.
+class UringReader final : public FileBatchReader {
+public:
+  static std::unique_ptr<FileBatchReader> Create(const unsigned int aEntries);
+
+  ~UringReader() override;
+
+  void Submit(const uint64_t aTag,
+              const std::filesystem::path &aPath) override;
+  std::optional<FileReadResult> WaitForCompletion() override;
+  const char *GetName() const override { return "io_uring"; }
+
+  UringReader(const UringReader &) = delete;
+  UringReader(UringReader &&) = delete;
+  UringReader &operator=(const UringReader &) = delete;
+  UringReader &operator=(UringReader &&) = delete;
+
+private:
+  struct PendingFile final {
+    uint64_t mSerial;
+    uint64_t mTag;
+    int mFd;
+    std::vector<uint8_t> mData;
+    size_t mNumOutstanding;
+    bool mFailed;
+  };
+
+  struct ChunkRead final {
+    PendingFile *mFile;
+    uint64_t mOffset;
+    // The kernel reads iovecs at submission time, but keeping it here means
+    // that short reads can simply be resubmitted.
+    struct iovec mIov;
+  };
+
+  UringReader(const int aRingFd, const io_uring_params &aParams);
+
+  bool MapRings();
+  void QueueChunks(PendingFile &aFile);
+  unsigned int FillSubmissionQueue();
+  void ReapCompletions();
+  void CompleteChunk(const uint32_t aSlot, const int aResult);
+  void FinishFile(PendingFile &aFile);
+  void Abandon();
+
+  // What Abandon hands over to the kernel for good; see there.
+  struct AbandonedReads final {
+    std::unordered_map<uint64_t, PendingFile> mFiles;
+    std::vector<ChunkRead> mSlots;
+  };
+
+  static void KeepAbandoned(std::unique_ptr<AbandonedReads> aReads);
+
+private:
+  static constexpr size_t kChunkSize = 1024 * 1024;
+
+  const int mRingFd;
+  const io_uring_params mParams;
+
+  void *mRings;
+  size_t mRingsSize;
+  void *mCompletionRing;
+  size_t mCompletionRingSize;
+  io_uring_sqe *mSqes;
+
+  unsigned int *mSqTail;
+  unsigned int *mSqMask;
+  unsigned int *mSqArray;
+  unsigned int *mCqHead;
+  unsigned int *mCqTail;
+  unsigned int *mCqMask;
+  io_uring_cqe *mCqes;
+
+  // Keyed by an internal serial number; node-based so that ChunkReads may
+  // point at their files.
+  std::unordered_map<uint64_t, PendingFile> mFiles;
+  uint64_t mNextSerial;
+  // Chunks waiting for room in the submission queue
+  std::deque<ChunkRead> mQueued;
+  // One slot per submission queue entry; the slot index is the user_data.
+  std::vector<ChunkRead> mSlots;
+  std::vector<uint32_t> mFreeSlots;
+  unsigned int mNumUnsubmitted;
+  std::deque<FileReadResult> mResults;
+  // Set once the ring can no longer be entered
+  bool mBroken;
+};
+
+} // anonymous namespace
+
+static int IoUringSetup(const unsigned int aEntries, io_uring_params &aParams) {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, aEntries, &aParams));
+}
+
+static int IoUringEnter(const int aRingFd, const unsigned int aToSubmit,
+                        const unsigned int aMinComplete,
+                        const unsigned int aFlags) {
+  return static_cast<int>(::syscall(__NR_io_uring_enter, aRingFd, aToSubmit,
+                                    aMinComplete, aFlags, nullptr, 0));
+}
+
+std::unique_ptr<FileBatchReader>
+UringReader::Create(const unsigned int aEntries) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  // Fails with ENOSYS on old kernels, or EPERM where io_uring is disabled.
+  const int ringFd = IoUringSetup(aEntries, params);
+  if (ringFd < 0) {
+    return nullptr;
+  }
+
+  std::unique_ptr<UringReader> reader(new UringReader(ringFd, params));
+  if (!reader->MapRings()) {
+    return nullptr;
+  }
+
+  return reader;
+}
+
+UringReader::UringReader(const int aRingFd, const io_uring_params &aParams)
+    : mRingFd(aRingFd), mParams(aParams), mRings(MAP_FAILED), mRingsSize(0),
+      mCompletionRing(MAP_FAILED), mCompletionRingSize(0), mSqes(nullptr),
+      mSqTail(nullptr), mSqMask(nullptr), mSqArray(nullptr), mCqHead(nullptr),
+      mCqTail(nullptr), mCqMask(nullptr), mCqes(nullptr), mNextSerial(0),
+      mSlots(aParams.sq_entries), mNumUnsubmitted(0), mBroken(false) {
+  for (uint32_t i = aParams.sq_entries; i-- > 0;) {
+    mFreeSlots.push_back(i);
+  }
+}
+
+UringReader::~UringReader() {
+  // The kernel may still be writing into our buffers, so wait for every read
+  // that it knows about before releasing them.
+  mQueued.clear();
+  while (mSqes && mFreeSlots.size() < mSlots.size()) {
+    const int submitted =
+        IoUringEnter(mRingFd, mNumUnsubmitted, 1, IORING_ENTER_GETEVENTS);
+    if (submitted < 0 && errno != EINTR && errno != EAGAIN &&
+        errno != EBUSY) {
+      Abandon();
+      break;
+    }
+
+    if (submitted > 0) {
+      mNumUnsubmitted -= static_cast<unsigned int>(submitted);
+    }
+
+    ReapCompletions();
+    mQueued.clear();
+  }
+
+  if (mSqes) {
+    ::munmap(mSqes, mParams.sq_entries * sizeof(io_uring_sqe));
+  }
+
+  if (mCompletionRing != MAP_FAILED && mCompletionRing != mRings) {
+    ::munmap(mCompletionRing, mCompletionRingSize);
+  }
+
+  if (mRings != MAP_FAILED) {
+    ::munmap(mRings, mRingsSize);
+  }
+
+  ::close(mRingFd);
+
+  for (auto &[serial, file] : mFiles) {
+    ::close(file.mFd);
+  }
+}
+
+bool UringReader::MapRings() {
+  const io_sqring_offsets &sqOff = mParams.sq_off;
+  const io_cqring_offsets &cqOff = mParams.cq_off;
+
+  mRingsSize = sqOff.array + (mParams.sq_entries * sizeof(unsigned int));
+  mCompletionRingSize =
+      cqOff.cqes + (mParams.cq_entries * sizeof(io_uring_cqe));
+
+  // Newer kernels share a single mapping between both rings.
+  const bool singleMap = mParams.features & IORING_FEAT_SINGLE_MMAP;
+  if (singleMap) {
+    mRingsSize = std::max(mRingsSize, mCompletionRingSize);
+  }
+
+  mRings = ::mmap(nullptr, mRingsSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQ_RING);
+  if (mRings == MAP_FAILED) {
+    return false;
+  }
+
+  if (singleMap) {
+    mCompletionRing = mRings;
+  } else {
+    mCompletionRing =
+        ::mmap(nullptr, mCompletionRingSize, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_CQ_RING);
+    if (mCompletionRing == MAP_FAILED) {
+      return false;
+    }
+  }
+
+  void *sqes = ::mmap(nullptr, mParams.sq_entries * sizeof(io_uring_sqe),
+                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      mRingFd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+
+  mSqes = static_cast<io_uring_sqe *>(sqes);
+
+  uint8_t *sq = static_cast<uint8_t *>(mRings);
+  mSqTail = reinterpret_cast<unsigned int *>(sq + sqOff.tail);
+  mSqMask = reinterpret_cast<unsigned int *>(sq + sqOff.ring_mask);
+  mSqArray = reinterpret_cast<unsigned int *>(sq + sqOff.array);
+
+  uint8_t *cq = static_cast<uint8_t *>(mCompletionRing);
+  mCqHead = reinterpret_cast<unsigned int *>(cq + cqOff.head);
+  mCqTail = reinterpret_cast<unsigned int *>(cq + cqOff.tail);
+  mCqMask = reinterpret_cast<unsigned int *>(cq + cqOff.ring_mask);
+  mCqes = reinterpret_cast<io_uring_cqe *>(cq + cqOff.cqes);
+  return true;
+}
+
+void UringReader::Submit(const uint64_t aTag,
+                         const std::filesystem::path &aPath) {
+  if (mBroken) {
+    mResults.push_back({aTag, std::nullopt});
+    return;
+  }
+
+  const int fd = ::open(aPath.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || ::fstat(fd, &st) || st.st_size < 0) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+
+    mResults.push_back({aTag, std::nullopt});
+    return;
+  }
+
+  const uint64_t serial = mNextSerial++;
+  auto [itr, inserted] = mFiles.emplace(
+      serial, PendingFile{serial, aTag, fd,
+                          std::vector<uint8_t>(st.st_size), 0, false});
+  QueueChunks(itr->second);
+}
+
+void UringReader::QueueChunks(PendingFile &aFile) {
+  for (size_t offset = 0; offset < aFile.mData.size(); offset += kChunkSize) {
+    const size_t len = std::min(kChunkSize, aFile.mData.size() - offset);
+    mQueued.push_back({&aFile, offset, {aFile.mData.data() + offset, len}});
+    ++aFile.mNumOutstanding;
+  }
+
+  if (!aFile.mNumOutstanding) {
+    FinishFile(aFile);
+  }
+}
+
+unsigned int UringReader::FillSubmissionQueue() {
+  // We are the only producer, so the tail is ours to read without ordering.
+  unsigned int tail = *mSqTail;
+  unsigned int numAdded = 0;
+  while (!mQueued.empty() && !mFreeSlots.empty()) {
+    const uint32_t slot = mFreeSlots.back();
+    mFreeSlots.pop_back();
+    ChunkRead &chunk = mSlots[slot];
+    chunk = mQueued.front();
+    mQueued.pop_front();
+
+    const unsigned int index = tail & *mSqMask;
+    io_uring_sqe &sqe = mSqes[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READV;
+    sqe.fd = chunk.mFile->mFd;
+    sqe.off = chunk.mOffset;
+    sqe.addr = reinterpret_cast<uintptr_t>(&chunk.mIov);
+    sqe.len = 1;
+    sqe.user_data = slot;
+    mSqArray[index] = index;
+    ++tail;
+    ++numAdded;
+  }
+
+  // Publish the new entries to the kernel.
+  __atomic_store_n(mSqTail, tail, __ATOMIC_RELEASE);
+  mNumUnsubmitted += numAdded;
+  return mNumUnsubmitted;
+}
+
+void UringReader::ReapCompletions() {
+  unsigned int head = *mCqHead;
+  const unsigned int tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    const io_uring_cqe &cqe = mCqes[head & *mCqMask];
+    CompleteChunk(static_cast<uint32_t>(cqe.user_data), cqe.res);
+  }
+
+  __atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+}
+
+void UringReader::CompleteChunk(const uint32_t aSlot, const int aResult) {
+  ChunkRead chunk = mSlots[aSlot];
+  mFreeSlots.push_back(aSlot);
+  PendingFile &file = *chunk.mFile;
+
+  if (aResult == -EAGAIN || aResult == -EINTR) {
+    mQueued.push_back(chunk);
+    return;
+  }
+
+  if (aResult <= 0) {
+    // Either an error, or the file shrank since we sized the buffer.
+    file.mFailed = true;
+  } else if (static_cast<size_t>(aResult) < chunk.mIov.iov_len) {
+    chunk.mOffset += aResult;
+    chunk.mIov.iov_base = static_cast<uint8_t *>(chunk.mIov.iov_base) + aResult;
+    chunk.mIov.iov_len -= aResult;
+    mQueued.push_back(chunk);
+    return;
+  }
+
+  if (!--file.mNumOutstanding) {
+    FinishFile(file);
+  }
+}
+
+void UringReader::FinishFile(PendingFile &aFile) {
+  ::close(aFile.mFd);
+
+  FileReadResult result{aFile.mTag, std::nullopt};
+  if (!aFile.mFailed) {
+    result.mData.emplace(std::move(aFile.mData));
+  }
+
+  mResults.push_back(std::move(result));
+
+  // Don't pass a reference into the node that we are erasing.
+  const uint64_t serial = aFile.mSerial;
+  mFiles.erase(serial);
+}
+
+// Fails everything still outstanding once the ring itself is broken. We can
+// no longer learn when the kernel is done with the reads that it already
+// holds, so rather than freeing their buffers and iovecs from under it, we
+// keep them for the rest of the process; the kernel cancels the reads once
+// the ring is closed.
+void UringReader::Abandon() {
+  mBroken = true;
+
+  for (auto &[serial, file] : mFiles) {
+    ::close(file.mFd);
+    mResults.push_back({file.mTag, std::nullopt});
+  }
+
+  if (mFreeSlots.size() < mSlots.size()) {
+    // Moving the containers wholesale keeps every node and buffer in place.
+    KeepAbandoned(std::unique_ptr<AbandonedReads>(
+        new AbandonedReads{std::move(mFiles), std::move(mSlots)}));
+  }
+
+  mFiles.clear();
+  mQueued.clear();
+  mSlots.clear();
+  mFreeSlots.clear();
+  mNumUnsubmitted = 0;
+}
+
+void UringReader::KeepAbandoned(std::unique_ptr<AbandonedReads> aReads) {
+  // Never destroyed, so that the memory stays both valid and reachable until
+  // the process exits. A ring essentially never breaks, so this does not
+  // grow in practice.
+  static std::mutex *sMutex = new std::mutex();
+  static std::vector<std::unique_ptr<AbandonedReads>> *sAbandoned =
+      new std::vector<std::unique_ptr<AbandonedReads>>();
+
+  std::lock_guard<std::mutex> lock(*sMutex);
+  sAbandoned->push_back(std::move(aReads));
+}
+
+std::optional<FileReadResult> UringReader::WaitForCompletion() {
+  while (mResults.empty()) {
+    if (mFiles.empty()) {
+      return std::nullopt;
+    }
+
+    const unsigned int toSubmit = FillSubmissionQueue();
+    const int submitted =
+        IoUringEnter(mRingFd, toSubmit, 1, IORING_ENTER_GETEVENTS);
+    if (submitted < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+        ReapCompletions();
+        continue;
+      }
+
+      Abandon();
+      break;
+    }
+
+    mNumUnsubmitted -= static_cast<unsigned int>(submitted);
+    ReapCompletions();
+  }
+
+  if (mResults.empty()) {
+    return std::nullopt;
+  }
+
+  FileReadResult result = std::move(mResults.front());
+  mResults.pop_front();
+  return result;
+}
+
+#endif // defined(APTINFO_HAVE_IO_URING)
+
+std::unique_ptr<FileBatchReader>
+FileBatchReader::Create(const unsigned int aQueueDepth) {
+  const unsigned int queueDepth = std::max(1U, aQueueDepth);
+
+#if defined(APTINFO_HAVE_IO_URING)
+  if (std::unique_ptr<FileBatchReader> reader =
+          UringReader::Create(queueDepth)) {
+    return reader;
+  }
+#endif // defined(APTINFO_HAVE_IO_URING)
+
+  return CreateThreadPool(queueDepth);
+}
+
+std::unique_ptr<FileBatchReader>
+FileBatchReader::CreateThreadPool(const unsigned int aNumThreads) {
+  return std::make_unique<ThreadPoolReader>(std::max(1U, aNumThreads));
+}
+
+} // namespace aptinfo
@@ -0,0 +1,58 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <stdint.h>
+
+namespace aptinfo {
+
+struct FileReadResult final {
+  uint64_t mTag;
+  // Empty when the file could not be opened or read in its entirety.
+  std::optional<std::vector<uint8_t>> mData;
+};
+
+// Reads whole files into memory, keeping many reads outstanding at once so
+// that slow storage is kept busy instead of stalling on one page fault at a
+// time. Not thread-safe: a single thread submits and reaps.
+class FileBatchReader {
+public:
+  // Uses io_uring when the kernel provides it, and otherwise a pool of
+  // aQueueDepth threads performing ordinary blocking reads.
+  static std::unique_ptr<FileBatchReader>
+  Create(const unsigned int aQueueDepth);
+
+  // Always uses the pool of threads, even where io_uring is available.
+  static std::unique_ptr<FileBatchReader>
+  CreateThreadPool(const unsigned int aNumThreads);
+
+  virtual ~FileBatchReader() = default;
+
+  virtual void Submit(const uint64_t aTag,
+                      const std::filesystem::path &aPath) = 0;
+
+  // Blocks until any submitted file has been read, in whatever order the
+  // storage completes them. Returns nothing once no reads are outstanding.
+  virtual std::optional<FileReadResult> WaitForCompletion() = 0;
+
+  virtual const char *GetName() const = 0;
+
+protected:
+  FileBatchReader() = default;
+
+  FileBatchReader(const FileBatchReader &) = delete;
+  FileBatchReader(FileBatchReader &&) = delete;
+  FileBatchReader &operator=(const FileBatchReader &) = delete;
+  FileBatchReader &operator=(FileBatchReader &&) = delete;
+};
+
+} // namespace aptinfo
@@ -0,0 +1,18 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Every on-disk format that we parse is little-endian, as is every host that
+// we run on. aPtr need not be aligned.
+template <typename T> static inline T ReadLE(const uint8_t *aPtr) {
+  T result;
+  memcpy(&result, aPtr, sizeof(T));
+  return result;
+}
@@ -0,0 +1,378 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "aptinfo.h"
+
+#include "hive.h"
+#include "hiveingest.h"
+#include "utils.h"
+
+namespace aptinfo {
+
+static constexpr int kMaxCurVerDepth = 8;
+
+static LSTATUS ToLStatus(const HiveStatus aStatus) {
+  switch (aStatus) {
+  case HiveStatus::Success:
+    return ERROR_SUCCESS;
+  case HiveStatus::CannotOpen:
+    return ERROR_OPEN_FAILED;
+  case HiveStatus::NotFound:
+    return ERROR_FILE_NOT_FOUND;
+  case HiveStatus::WrongType:
+    return ERROR_UNSUPPORTED_TYPE;
+  case HiveStatus::NotAHive:
+  case HiveStatus::Corrupt:
+  default:
+    return ERROR_BADDB;
+  }
+}
+
+ClassStore::ClassStore(HKEY aHive, HKEY aRoot)
+    : mHive(aHive), mRoot(aRoot), mHiveCopyRoot(0) {}
+
+ClassStore::ClassStore(std::unique_ptr<Hive> &&aHiveCopy,
+                       const uint32_t aHiveCopyRoot)
+    : mHive(nullptr), mRoot(nullptr), mHiveCopy(std::move(aHiveCopy)),
+      mHiveCopyRoot(aHiveCopyRoot) {}
+
+ClassStore::~ClassStore() {
+  if (!mHive) {
+    return;
+  }
+
+  if (mRoot != mHive) {
+    ::RegCloseKey(mRoot);
+  }
+
+  // Closing the last handle to an app key unloads its hive.
+  ::RegCloseKey(mHive);
+}
+
+std::unique_ptr<ClassStore> ClassStore::OpenSystem() {
+  return std::unique_ptr<ClassStore>(
+      new ClassStore(nullptr, HKEY_CLASSES_ROOT));
+}
+
+std::variant<std::unique_ptr<ClassStore>, LSTATUS>
+ClassStore::OpenHive(const wchar_t *aHivePath) {
+  HKEY hive;
+  LSTATUS result =
+      ::RegLoadAppKeyW(aHivePath, &hive, KEY_READ, REG_PROCESS_APPKEY, 0);
+  if (result != ERROR_SUCCESS) {
+    return result;
+  }
+
+  // UsrClass.dat hives are rooted at the classes key, while SOFTWARE hives
+  // keep their classes under a subkey.
+  HKEY root;
+  result = ::RegOpenKeyExW(hive, L"CLSID", 0, KEY_READ, &root);
+  if (result == ERROR_SUCCESS) {
+    ::RegCloseKey(root);
+    return std::unique_ptr<ClassStore>(new ClassStore(hive, hive));
+  }
+
+  result = ::RegOpenKeyExW(hive, L"Classes", 0, KEY_READ, &root);
+  if (result != ERROR_SUCCESS) {
+    ::RegCloseKey(hive);
+    return result;
+  }
+
+  return std::unique_ptr<ClassStore>(new ClassStore(hive, root));
+}
+
+std::variant<std::unique_ptr<ClassStore>, LSTATUS>
+ClassStore::OpenHiveCopy(const wchar_t *aHivePath) {
+  std::variant<Hive, HiveStatus> maybeHive = Hive::Open(aHivePath);
+  if (std::holds_alternative<HiveStatus>(maybeHive)) {
+    return ToLStatus(std::get<HiveStatus>(maybeHive));
+  }
+
+  return FromHiveCopy(
+      std::make_unique<Hive>(std::move(std::get<Hive>(maybeHive))));
+}
+
+void ClassStore::OpenHiveCopies(
+    const std::vector<std::wstring> &aHivePaths,
+    const unsigned int aMaxInFlight,
+    const std::function<void(
+        size_t, std::variant<std::unique_ptr<ClassStore>, LSTATUS> &&)>
+        &aOnStore) {
+  std::vector<std::filesystem::path> paths(aHivePaths.begin(),
+                                           aHivePaths.end());
+
+  IngestOptions options;
+  options.mMaxHivesInFlight = aMaxInFlight;
+
+  IngestHives(paths, options,
+              [&aOnStore](const size_t aIndex,
+                          std::variant<Hive, HiveStatus> &&aHive) {
+                if (std::holds_alternative<HiveStatus>(aHive)) {
+                  aOnStore(aIndex, ToLStatus(std::get<HiveStatus>(aHive)));
+                  return;
+                }
+
+                aOnStore(aIndex, FromHiveCopy(std::make_unique<Hive>(
+                                     std::move(std::get<Hive>(aHive)))));
+              });
+}
+
+std::variant<std::unique_ptr<ClassStore>, LSTATUS>
+ClassStore::FromHiveCopy(std::unique_ptr<Hive> &&aHiveCopy) {
+  std::unique_ptr<Hive> hive(std::move(aHiveCopy));
+
+  // As with OpenHive, accept both UsrClass.dat and SOFTWARE hives.
+  CellIndex root = hive->GetRootKey();
+  CellIndex clsid;
+  HiveStatus status = hive->FindKey(root, L"CLSID", clsid);
+  if (status == HiveStatus::NotFound) {
+    status = hive->FindKey(root, L"Classes", root);
+  }
+
+  if (status != HiveStatus::Success) {
+    return ToLStatus(status);
+  }
+
+  return std::unique_ptr<ClassStore>(new ClassStore(std::move(hive), root));
+}
+
+uint32_t ClassStore::GetNumReplayedLogEntries() const {
+  return mHiveCopy ? mHiveCopy->GetNumLogEntriesApplied() : 0;
+}
+
+LSTATUS ClassStore::GetString(const std::wstring &aSubKey,
+                              const wchar_t *aValueName,
+                              std::wstring &aValue) const {
+  if (mHiveCopy) {
+    CellIndex key;
+    HiveStatus status = mHiveCopy->FindKey(mHiveCopyRoot, aSubKey, key);
+    if (status == HiveStatus::Success) {
+      status = mHiveCopy->GetString(
+          key, aValueName ? aValueName : std::wstring_view(), aValue);
+    }
+
+    return ToLStatus(status);
+  }
+
+  const wchar_t *subKey = aSubKey.empty() ? nullptr : aSubKey.c_str();
+
+  // Nearly every value that we read fits in here.
+  wchar_t buf[MAX_PATH + 1];
+  DWORD numBytes = sizeof(buf);
+  LSTATUS result = ::RegGetValueW(mRoot, subKey, aValueName, RRF_RT_REG_SZ,
+                                  nullptr, buf, &numBytes);
+  if (result == ERROR_SUCCESS) {
+    aValue = BufToView(buf, numBytes);
+    return result;
+  }
+
+  std::vector<wchar_t> heapBuf;
+  while (result == ERROR_MORE_DATA) {
+    heapBuf.resize((numBytes / sizeof(wchar_t)) + 1);
+    numBytes = static_cast<DWORD>(heapBuf.size() * sizeof(wchar_t));
+    result = ::RegGetValueW(mRoot, subKey, aValueName, RRF_RT_REG_SZ, nullptr,
+                            heapBuf.data(), &numBytes);
+  }
+
+  if (result == ERROR_SUCCESS) {
+    aValue = BufToView(heapBuf.data(), numBytes);
+  }
+
+  return result;
+}
+
+LSTATUS ClassStore::HasValue(const std::wstring &aSubKey,
+                             const wchar_t *aValueName) const {
+  if (mHiveCopy) {
+    CellIndex key;
+    HiveStatus status = mHiveCopy->FindKey(mHiveCopyRoot, aSubKey, key);
+    if (status == HiveStatus::Success) {
+      status = mHiveCopy->HasValue(
+          key, aValueName ? aValueName : std::wstring_view());
+    }
+
+    return ToLStatus(status);
+  }
+
+  // We only care about presence, so don't bother fetching any data.
+  return ::RegGetValueW(mRoot, aSubKey.empty() ? nullptr : aSubKey.c_str(),
+                        aValueName, RRF_RT_ANY, nullptr, nullptr, nullptr);
+}
+
+LSTATUS ClassStore::HasKey(const std::wstring &aSubKey) const {
+  if (mHiveCopy) {
+    CellIndex key;
+    return ToLStatus(mHiveCopy->FindKey(mHiveCopyRoot, aSubKey, key));
+  }
+
+  HKEY key;
+  LSTATUS result = ::RegOpenKeyExW(mRoot, aSubKey.c_str(), 0, KEY_READ, &key);
+  if (result == ERROR_SUCCESS) {
+    ::RegCloseKey(key);
+  }
+
+  return result;
+}
+
+LSTATUS ClassStore::EnumSubKeys(
+    const std::wstring &aSubKey,
+    const std::function<void(const std::wstring_view &)> &aCallback) const {
+  if (mHiveCopy) {
+    CellIndex key;
+    HiveStatus status = mHiveCopy->FindKey(mHiveCopyRoot, aSubKey, key);
+    if (status == HiveStatus::Success) {
+      status = mHiveCopy->EnumSubKeys(key, aCallback);
+    }
+
+    return ToLStatus(status);
+  }
+
+  HKEY key = mRoot;
+  if (!aSubKey.empty()) {
+    LSTATUS result =
+        ::RegOpenKeyExW(mRoot, aSubKey.c_str(), 0, KEY_READ, &key);
+    if (result != ERROR_SUCCESS) {
+      return result;
+    }
+  }
+
+  auto closeOnExit = MakeScopeExit([this, key]() {
+    if (key != mRoot) {
+      ::RegCloseKey(key);
+    }
+  });
+
+  wchar_t name[kMaxKeyNameLen + 1];
+  for (DWORD i = 0;; ++i) {
+    DWORD nameLen = static_cast<DWORD>(ArrayLength(name));
+    LSTATUS result = ::RegEnumKeyExW(key, i, name, &nameLen, nullptr, nullptr,
+                                     nullptr, nullptr);
+    if (result == ERROR_NO_MORE_ITEMS) {
+      return ERROR_SUCCESS;
+    }
+
+    if (result != ERROR_SUCCESS) {
+      return result;
+    }
+
+    aCallback(std::wstring_view(name, nameLen));
+  }
+}
+
+std::variant<const ProgIDIndex *, LSTATUS> ClassStore::GetProgIDIndex() const {
+  std::call_once(mProgIDIndexOnce,
+                 [this]() { mProgIDIndex.emplace(ProgIDIndex::Build(*this)); });
+
+  const std::variant<ProgIDIndex, LSTATUS> &index = mProgIDIndex.value();
+  if (std::holds_alternative<LSTATUS>(index)) {
+    return std::get<LSTATUS>(index);
+  }
+
+  return &std::get<ProgIDIndex>(index);
+}
+
+void ProgIDIndex::AddReverse(REFCLSID aClsid, const std::wstring &aProgID,
+                             const bool aIsVersionIndependent) {
+  // Prefer version-independent ProgIDs for naming since they are stable
+  // across upgrades of the server.
+  auto [itr, inserted] = mProgIDs.emplace(aClsid, aProgID);
+  if (!inserted && aIsVersionIndependent) {
+    itr->second = aProgID;
+  }
+}
+
+std::variant<ProgIDIndex, LSTATUS>
+ProgIDIndex::Build(const ClassStore &aStore) {
+  ProgIDIndex index;
+
+  // Version-independent ProgIDs without their own CLSID, keyed by folded
+  // ProgID. Each entry holds the original ProgID and the (folded) ProgID that
+  // its CurVer subkey names.
+  std::unordered_map<std::wstring, std::pair<std::wstring, std::wstring>>
+      curVers;
+
+  LSTATUS result = aStore.EnumSubKeys(
+      std::wstring(),
+      [&aStore, &index, &curVers](const std::wstring_view &aName) {
+        // File extensions and GUID-named keys are never ProgIDs.
+        if (aName[0] == L'.' || aName[0] == L'{') {
+          return;
+        }
+
+        const std::wstring progId(aName);
+
+        std::wstring curVer;
+        if (aStore.GetString(progId + L"\\CurVer", nullptr, curVer) !=
+            ERROR_SUCCESS) {
+          curVer.clear();
+        }
+
+        std::wstring strClsid;
+        CLSID clsid;
+        if (aStore.GetString(progId + L"\\CLSID", nullptr, strClsid) ==
+                ERROR_SUCCESS &&
+            SUCCEEDED(::CLSIDFromString(strClsid.c_str(), &clsid))) {
+          index.mClsids.emplace(FoldCase(progId), clsid);
+          index.AddReverse(clsid, progId, !curVer.empty());
+          return;
+        }
+
+        if (!curVer.empty()) {
+          curVers.emplace(FoldCase(progId),
+                          std::make_pair(progId, FoldCase(curVer)));
+        }
+      });
+  if (result != ERROR_SUCCESS) {
+    return result;
+  }
+
+  // Now that every versioned ProgID is known, resolve the CurVer redirections
+  // ahead of time so that lookups never need to chase them.
+  for (auto &[foldedProgId, entry] : curVers) {
+    const std::wstring *target = &entry.second;
+    for (int depth = 0; depth < kMaxCurVerDepth; ++depth) {
+      auto itr = index.mClsids.find(*target);
+      if (itr != index.mClsids.end()) {
+        const CLSID clsid = itr->second;
+        index.mClsids.emplace(foldedProgId, clsid);
+        index.AddReverse(clsid, entry.first, true);
+        break;
+      }
+
+      // CurVer may itself name another version-independent ProgID.
+      auto next = curVers.find(*target);
+      if (next == curVers.end()) {
+        break;
+      }
+
+      target = &next->second.second;
+    }
+  }
+
+  return index;
+}
+
+std::optional<CLSID>
+ProgIDIndex::Lookup(const std::wstring_view &aProgID) const {
+  auto itr = mClsids.find(FoldCase(aProgID));
+  if (itr == mClsids.end()) {
+    return std::nullopt;
+  }
+
+  return itr->second;
+}
+
+std::optional<std::wstring_view>
+ProgIDIndex::GetProgID(REFCLSID aClsid) const {
+  auto itr = mProgIDs.find(aClsid);
+  if (itr == mProgIDs.end()) {
+    return std::nullopt;
+  }
+
+  return std::wstring_view(itr->second);
+}
+
+} // namespace aptinfo
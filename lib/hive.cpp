@@ -0,0 +1,872 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "hive.h"
+
+#include <algorithm>
+#include <cwctype>
+
+#include "byteorder.h"
+
+namespace aptinfo {
+
+static constexpr size_t kBaseBlockSize = 4096;
+// Logs only store the first sector of their base block.
+static constexpr size_t kSectorSize = 512;
+static constexpr size_t kChecksumOffset = 508;
+// Cell indices are 31 bits wide; the top bit selects volatile storage.
+static constexpr size_t kMaxBinsSize = 0x80000000U;
+
+// Base block fields
+static constexpr size_t kPrimarySequenceOffset = 0x04;
+static constexpr size_t kSecondarySequenceOffset = 0x08;
+static constexpr size_t kMajorVersionOffset = 0x14;
+static constexpr size_t kMinorVersionOffset = 0x18;
+static constexpr size_t kFileTypeOffset = 0x1C;
+static constexpr size_t kRootCellOffset = 0x24;
+static constexpr size_t kBinsSizeOffset = 0x28;
+
+static constexpr uint32_t kFileTypePrimary = 0;
+static constexpr uint32_t kFileTypeLog1 = 1;
+static constexpr uint32_t kFileTypeLog2 = 2;
+// Windows 8.1 and newer
+static constexpr uint32_t kFileTypeLogIncremental = 6;
+
+// Incremental (HvLE) log entries
+static constexpr size_t kLogEntryHeaderSize = 40;
+static constexpr uint64_t kLogEntryHashSeed = 0x82EF4D887A4E55C5ULL;
+
+// Key nodes
+static constexpr size_t kKeyNodeHeaderSize = 0x4C;
+static constexpr uint16_t kKeyCompressedName = 0x0020;
+// Value keys
+static constexpr size_t kValueKeyHeaderSize = 0x14;
+static constexpr uint16_t kValueCompressedName = 0x0001;
+static constexpr uint32_t kValueDataInline = 0x80000000U;
+static constexpr size_t kMaxBigDataSegmentSize = 16344;
+// Big data cells were introduced with hive version 1.4.
+static constexpr uint32_t kMinBigDataMinorVersion = 4;
+
+static constexpr uint32_t kRegSz = 1;
+static constexpr uint32_t kRegExpandSz = 2;
+
+// Guards against cycles between index roots.
+static constexpr int kMaxSubKeyListDepth = 8;
+
+namespace {
+
+struct LogEntry final {
+  // The base block of the log that holds this entry
+  const uint8_t *mLog;
+  uint32_t mSequence;
+  uint32_t mBinsSize;
+  uint32_t mNumPages;
+  // Pairs of (offset within the bins data, size)
+  const uint8_t *mPageRefs;
+  const uint8_t *mPages;
+};
+
+} // anonymous namespace
+
+static uint32_t ComputeBaseBlockChecksum(const uint8_t *aBlock) {
+  uint32_t result = 0;
+  for (size_t i = 0; i < kChecksumOffset; i += sizeof(uint32_t)) {
+    result ^= ReadLE<uint32_t>(aBlock + i);
+  }
+
+  // Neither of these values may be stored.
+  if (result == 0xFFFFFFFFU) {
+    return 0xFFFFFFFEU;
+  }
+
+  if (!result) {
+    return 1;
+  }
+
+  return result;
+}
+
+static bool IsValidBaseBlock(const uint8_t *aBlock, const size_t aSize) {
+  return aSize >= kSectorSize && !memcmp(aBlock, "regf", 4) &&
+         ReadLE<uint32_t>(aBlock + kChecksumOffset) ==
+             ComputeBaseBlockChecksum(aBlock);
+}
+
+static uint32_t RotateLeft(const uint32_t aValue, const int aShift) {
+  return (aValue << aShift) | (aValue >> (32 - aShift));
+}
+
+static uint64_t Marvin32(const uint8_t *aData, size_t aLen) {
+  uint32_t lo = static_cast<uint32_t>(kLogEntryHashSeed);
+  uint32_t hi = static_cast<uint32_t>(kLogEntryHashSeed >> 32);
+
+  auto mix = [&lo, &hi]() {
+    hi ^= lo;
+    lo = RotateLeft(lo, 20);
+    lo += hi;
+    hi = RotateLeft(hi, 9);
+    hi ^= lo;
+    lo = RotateLeft(lo, 27);
+    lo += hi;
+    hi = RotateLeft(hi, 19);
+  };
+
+  for (; aLen >= sizeof(uint32_t);
+       aData += sizeof(uint32_t), aLen -= sizeof(uint32_t)) {
+    lo += ReadLE<uint32_t>(aData);
+    mix();
+  }
+
+  // The final block is padded with a single 0x80 byte.
+  uint32_t last = 0x80;
+  for (size_t i = aLen; i-- > 0;) {
+    last = (last << 8) | aData[i];
+  }
+
+  lo += last;
+  mix();
+  mix();
+
+  return (static_cast<uint64_t>(hi) << 32) | lo;
+}
+
+// Collects the valid, consecutive entries of an incremental log. Anything
+// following the first invalid entry was never completely written.
+static void ReadLogEntries(const uint8_t *aLog, const size_t aSize,
+                           std::vector<LogEntry> &aEntries) {
+  std::optional<uint32_t> expectedSequence;
+
+  size_t offset = kSectorSize;
+  while (offset + kLogEntryHeaderSize <= aSize) {
+    const uint8_t *entry = aLog + offset;
+    const uint32_t entrySize = ReadLE<uint32_t>(entry + 4);
+    if (memcmp(entry, "HvLE", 4) || entrySize < kLogEntryHeaderSize ||
+        entrySize % kSectorSize || entrySize > aSize - offset) {
+      return;
+    }
+
+    const uint32_t sequence = ReadLE<uint32_t>(entry + 12);
+    if (expectedSequence && sequence != expectedSequence.value()) {
+      return;
+    }
+
+    if (Marvin32(entry + kLogEntryHeaderSize,
+                 entrySize - kLogEntryHeaderSize) !=
+            ReadLE<uint64_t>(entry + 24) ||
+        Marvin32(entry, 32) != ReadLE<uint64_t>(entry + 32)) {
+      return;
+    }
+
+    const uint32_t binsSize = ReadLE<uint32_t>(entry + 16);
+    const uint32_t numPages = ReadLE<uint32_t>(entry + 20);
+    const size_t payloadSize = entrySize - kLogEntryHeaderSize;
+    if (binsSize > kMaxBinsSize ||
+        numPages > payloadSize / (2 * sizeof(uint32_t))) {
+      return;
+    }
+
+    const uint8_t *pageRefs = entry + kLogEntryHeaderSize;
+    size_t pagesSize = 0;
+    for (uint32_t i = 0; i < numPages; ++i) {
+      const uint32_t pageOffset =
+          ReadLE<uint32_t>(pageRefs + (i * 2 * sizeof(uint32_t)));
+      const uint32_t pageSize = ReadLE<uint32_t>(
+          pageRefs + (i * 2 * sizeof(uint32_t)) + sizeof(uint32_t));
+      if (pageOffset > binsSize || pageSize > binsSize - pageOffset) {
+        return;
+      }
+
+      pagesSize += pageSize;
+    }
+
+    const size_t refsSize = numPages * 2 * sizeof(uint32_t);
+    if (pagesSize > payloadSize - refsSize) {
+      return;
+    }
+
+    aEntries.push_back(
+        {aLog, sequence, binsSize, numPages, pageRefs, pageRefs + refsSize});
+    expectedSequence = sequence + 1;
+    offset += entrySize;
+  }
+}
+
+static wchar_t FoldChar(const wchar_t aChar) {
+  if (aChar >= L'a' && aChar <= L'z') {
+    return static_cast<wchar_t>(aChar - (L'a' - L'A'));
+  }
+
+  if (aChar < 0x80) {
+    return aChar;
+  }
+
+  return static_cast<wchar_t>(std::towupper(static_cast<wint_t>(aChar)));
+}
+
+static bool NamesEqual(const std::wstring_view &aLeft,
+                       const std::wstring_view &aRight) {
+  return aLeft.size() == aRight.size() &&
+         std::equal(aLeft.begin(), aLeft.end(), aRight.begin(),
+                    [](const wchar_t aL, const wchar_t aR) {
+                      return FoldChar(aL) == FoldChar(aR);
+                    });
+}
+
+// The hash stored by "lh" subkey lists. We only compute it for ASCII names,
+// since we cannot reproduce the kernel's upcase table for anything else.
+static std::optional<uint32_t> HashKeyName(const std::wstring_view &aName) {
+  uint32_t hash = 0;
+  for (const wchar_t c : aName) {
+    if (static_cast<uint32_t>(c) >= 0x80) {
+      return std::nullopt;
+    }
+
+    hash = (hash * 37) + static_cast<uint32_t>(FoldChar(c));
+  }
+
+  return hash;
+}
+
+// Names are either Latin-1 ("compressed") or UTF-16LE. Decoding stops at the
+// first null, if any.
+static void DecodeString(const uint8_t *aStr, const size_t aNumBytes,
+                         const bool aCompressed, std::wstring &aResult) {
+  aResult.clear();
+
+  if (aCompressed) {
+    for (size_t i = 0; i < aNumBytes && aStr[i]; ++i) {
+      aResult.push_back(static_cast<wchar_t>(aStr[i]));
+    }
+
+    return;
+  }
+
+  for (size_t i = 0; i + 1 < aNumBytes; i += sizeof(char16_t)) {
+    const uint32_t unit = ReadLE<uint16_t>(aStr + i);
+    if (!unit) {
+      return;
+    }
+
+    // Combine surrogate pairs where wchar_t is UTF-32.
+    if constexpr (sizeof(wchar_t) > sizeof(char16_t)) {
+      if (unit >= 0xD800 && unit < 0xDC00 && i + 3 < aNumBytes) {
+        const uint32_t low = ReadLE<uint16_t>(aStr + i + sizeof(char16_t));
+        if (low >= 0xDC00 && low < 0xE000) {
+          aResult.push_back(static_cast<wchar_t>(
+              0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00)));
+          i += sizeof(char16_t);
+          continue;
+        }
+      }
+    }
+
+    aResult.push_back(static_cast<wchar_t>(unit));
+  }
+}
+
+Hive::Hive(Storage &&aStorage)
+    : mStorage(std::move(aStorage)), mData(nullptr), mBinsSize(0),
+      mMinorVersion(0), mRootKey(0), mWasDirty(false),
+      mNumLogEntriesApplied(0) {
+  if (std::holds_alternative<MappedFile>(mStorage)) {
+    mData = std::get<MappedFile>(mStorage).GetWritableData();
+  } else {
+    mData = std::get<std::vector<uint8_t>>(mStorage).data();
+  }
+}
+
+std::vector<std::filesystem::path>
+Hive::GetLogPaths(const std::filesystem::path &aPath) {
+  std::vector<std::filesystem::path> result;
+  for (const char *extension : {".LOG1", ".LOG2"}) {
+    result.push_back(aPath);
+    result.back() += extension;
+  }
+
+  return result;
+}
+
+std::variant<Hive, HiveStatus> Hive::Open(const std::filesystem::path &aPath) {
+  std::optional<MappedFile> file =
+      MappedFile::Open(aPath, MappedFile::Access::CopyOnWrite);
+  if (!file) {
+    return HiveStatus::CannotOpen;
+  }
+
+  // The logs only need to stay mapped until they have been replayed.
+  std::vector<MappedFile> logs;
+  std::vector<LogView> logViews;
+  for (const std::filesystem::path &logPath : GetLogPaths(aPath)) {
+    if (std::optional<MappedFile> log = MappedFile::Open(logPath)) {
+      logViews.emplace_back(log->GetData(), log->GetSize());
+      logs.push_back(std::move(log.value()));
+    }
+  }
+
+  return Load(Hive(std::move(file.value())), logViews);
+}
+
+std::variant<Hive, HiveStatus>
+Hive::FromBuffers(std::vector<uint8_t> &&aHive,
+                  const std::vector<std::vector<uint8_t>> &aLogs) {
+  std::vector<LogView> logViews;
+  for (const std::vector<uint8_t> &log : aLogs) {
+    logViews.emplace_back(log.data(), log.size());
+  }
+
+  return Load(Hive(std::move(aHive)), logViews);
+}
+
+std::variant<Hive, HiveStatus> Hive::Load(Hive &&aHive,
+                                          const std::vector<LogView> &aLogs) {
+  Hive hive(std::move(aHive));
+  if (!hive.ReadBaseBlock()) {
+    return HiveStatus::NotAHive;
+  }
+
+  hive.ReplayLogs(aLogs);
+
+  // Tolerate a truncated copy; any cells past its end read as corrupt.
+  hive.mBinsSize =
+      std::min(hive.mBinsSize, hive.GetStorageSize() - kBaseBlockSize);
+
+  uint32_t rootSize;
+  if (!hive.GetKeyNode(hive.mRootKey, rootSize)) {
+    return HiveStatus::Corrupt;
+  }
+
+  return hive;
+}
+
+size_t Hive::GetStorageSize() const {
+  if (std::holds_alternative<MappedFile>(mStorage)) {
+    return std::get<MappedFile>(mStorage).GetSize();
+  }
+
+  return std::get<std::vector<uint8_t>>(mStorage).size();
+}
+
+bool Hive::ReadBaseBlock() {
+  if (GetStorageSize() < kBaseBlockSize ||
+      !IsValidBaseBlock(mData, kBaseBlockSize) ||
+      ReadLE<uint32_t>(mData + kMajorVersionOffset) != 1 ||
+      ReadLE<uint32_t>(mData + kFileTypeOffset) != kFileTypePrimary) {
+    return false;
+  }
+
+  mMinorVersion = ReadLE<uint32_t>(mData + kMinorVersionOffset);
+  mRootKey = ReadLE<uint32_t>(mData + kRootCellOffset);
+  mBinsSize = std::min<size_t>(ReadLE<uint32_t>(mData + kBinsSizeOffset),
+                               kMaxBinsSize);
+  mWasDirty = ReadLE<uint32_t>(mData + kPrimarySequenceOffset) !=
+              ReadLE<uint32_t>(mData + kSecondarySequenceOffset);
+  return true;
+}
+
+bool Hive::Reserve(const size_t aBinsSize) {
+  const size_t required = kBaseBlockSize + aBinsSize;
+  const size_t available = GetStorageSize();
+  if (required <= available) {
+    return true;
+  }
+
+  // The logs grew the hive past the end of the file, which we cannot map.
+  // This is rare enough that a private copy is acceptable.
+  std::vector<uint8_t> copy(required);
+  memcpy(copy.data(), mData, available);
+  mData = mStorage.emplace<std::vector<uint8_t>>(std::move(copy)).data();
+  return true;
+}
+
+void Hive::ReplayLogs(const std::vector<LogView> &aLogs) {
+  const uint32_t hiveSequence =
+      ReadLE<uint32_t>(mData + kSecondarySequenceOffset);
+
+  std::vector<LogEntry> entries;
+  // Old-style logs hold every dirty sector at once, so only the newest one
+  // is ever replayed.
+  const uint8_t *fullLog = nullptr;
+  size_t fullLogSize = 0;
+
+  for (const auto &[data, size] : aLogs) {
+    if (!IsValidBaseBlock(data, size)) {
+      continue;
+    }
+
+    switch (ReadLE<uint32_t>(data + kFileTypeOffset)) {
+    case kFileTypeLogIncremental:
+      ReadLogEntries(data, size, entries);
+      break;
+    case kFileTypeLog1:
+    case kFileTypeLog2: {
+      // An old-style log is only complete when both of its sequence numbers
+      // match, and only relevant to a dirty hive.
+      const uint32_t sequence = ReadLE<uint32_t>(data + kPrimarySequenceOffset);
+      if (!mWasDirty ||
+          sequence != ReadLE<uint32_t>(data + kSecondarySequenceOffset) ||
+          sequence < hiveSequence) {
+        break;
+      }
+
+      if (!fullLog ||
+          sequence > ReadLE<uint32_t>(fullLog + kPrimarySequenceOffset)) {
+        fullLog = data;
+        fullLogSize = size;
+      }
+
+      break;
+    }
+    default:
+      break;
+    }
+  }
+
+  // Entries older than the hive's own sequence number were already
+  // reconciled into it. Both logs may contribute to a single run of entries,
+  // and when both hold the same entry, the copy in the newer log wins.
+  entries.erase(std::remove_if(entries.begin(), entries.end(),
+                               [hiveSequence](const LogEntry &aEntry) {
+                                 return aEntry.mSequence < hiveSequence;
+                               }),
+                entries.end());
+  std::stable_sort(entries.begin(), entries.end(),
+                   [](const LogEntry &aLeft, const LogEntry &aRight) {
+                     if (aLeft.mSequence != aRight.mSequence) {
+                       return aLeft.mSequence < aRight.mSequence;
+                     }
+
+                     return ReadLE<uint32_t>(aLeft.mLog +
+                                             kPrimarySequenceOffset) >
+                            ReadLE<uint32_t>(aRight.mLog +
+                                             kPrimarySequenceOffset);
+                   });
+  entries.erase(std::unique(entries.begin(), entries.end(),
+                            [](const LogEntry &aLeft, const LogEntry &aRight) {
+                              return aLeft.mSequence == aRight.mSequence;
+                            }),
+                entries.end());
+
+  // The run must begin exactly where the hive left off. Applying entries
+  // after a gap would layer them onto a hive that lacks the writes in
+  // between, so in that case the kernel replays nothing, and so do we.
+  if (!entries.empty() && entries[0].mSequence != hiveSequence) {
+    entries.clear();
+  }
+
+  size_t numEntries = 0;
+  size_t binsSize = mBinsSize;
+  for (; numEntries < entries.size(); ++numEntries) {
+    if (numEntries &&
+        entries[numEntries].mSequence !=
+            entries[numEntries - 1].mSequence + 1) {
+      break;
+    }
+
+    binsSize = std::max<size_t>(binsSize, entries[numEntries].mBinsSize);
+  }
+
+  if (numEntries && Reserve(binsSize)) {
+    uint8_t *bins = mData + kBaseBlockSize;
+    for (size_t i = 0; i < numEntries; ++i) {
+      const LogEntry &entry = entries[i];
+      const uint8_t *page = entry.mPages;
+      for (uint32_t ref = 0; ref < entry.mNumPages; ++ref) {
+        const uint8_t *pageRef = entry.mPageRefs + (ref * 2 * sizeof(uint32_t));
+        const uint32_t pageOffset = ReadLE<uint32_t>(pageRef);
+        const uint32_t pageSize =
+            ReadLE<uint32_t>(pageRef + sizeof(uint32_t));
+        // The first write to each page copies it, leaving the file intact.
+        memcpy(bins + pageOffset, page, pageSize);
+        page += pageSize;
+      }
+    }
+
+    // The log's base block describes the hive as of its last entry, and
+    // the root may have moved since the hive was written.
+    const LogEntry &last = entries[numEntries - 1];
+    mBinsSize = last.mBinsSize;
+    mRootKey = ReadLE<uint32_t>(last.mLog + kRootCellOffset);
+    mNumLogEntriesApplied = static_cast<uint32_t>(numEntries);
+    return;
+  }
+
+  if (!fullLog) {
+    return;
+  }
+
+  // The dirty vector follows the base block, and holds one bit per sector of
+  // the bins data. The dirty sectors themselves follow it, in order.
+  const size_t logBinsSize = std::min<size_t>(
+      ReadLE<uint32_t>(fullLog + kBinsSizeOffset), kMaxBinsSize);
+  const size_t numSectors = logBinsSize / kSectorSize;
+  const size_t bitmapSize = (numSectors + 7) / 8;
+  const size_t vectorOffset = kSectorSize;
+  size_t sectorOffset = vectorOffset + 4 + bitmapSize;
+  sectorOffset = ((sectorOffset + kSectorSize - 1) / kSectorSize) * kSectorSize;
+  if (sectorOffset > fullLogSize || memcmp(fullLog + vectorOffset, "DIRT", 4) ||
+      !Reserve(logBinsSize)) {
+    return;
+  }
+
+  const uint8_t *bitmap = fullLog + vectorOffset + 4;
+  uint8_t *bins = mData + kBaseBlockSize;
+  for (size_t sector = 0; sector < numSectors; ++sector) {
+    if (!(bitmap[sector / 8] & (1 << (sector % 8)))) {
+      continue;
+    }
+
+    if (fullLogSize - sectorOffset < kSectorSize) {
+      // Truncated log; whatever we already copied is still newer than the
+      // hive.
+      break;
+    }
+
+    memcpy(bins + (sector * kSectorSize), fullLog + sectorOffset, kSectorSize);
+    sectorOffset += kSectorSize;
+  }
+
+  mBinsSize = logBinsSize;
+  mRootKey = ReadLE<uint32_t>(fullLog + kRootCellOffset);
+  mNumLogEntriesApplied = 1;
+}
+
+const uint8_t *Hive::GetCell(const CellIndex aIndex, uint32_t &aSize) const {
+  if (aIndex >= mBinsSize || mBinsSize - aIndex < sizeof(int32_t)) {
+    return nullptr;
+  }
+
+  const uint8_t *cell = mData + kBaseBlockSize + aIndex;
+
+  // Allocated cells have negative sizes, which include the size field.
+  const int32_t rawSize = ReadLE<int32_t>(cell);
+  if (rawSize >= -static_cast<int32_t>(sizeof(int32_t)) ||
+      rawSize == INT32_MIN) {
+    return nullptr;
+  }
+
+  const uint32_t size = static_cast<uint32_t>(-rawSize);
+  if (size > mBinsSize - aIndex) {
+    return nullptr;
+  }
+
+  aSize = size - sizeof(int32_t);
+  return cell + sizeof(int32_t);
+}
+
+const uint8_t *Hive::GetKeyNode(const CellIndex aIndex, uint32_t &aSize) const {
+  const uint8_t *node = GetCell(aIndex, aSize);
+  if (!node || aSize < kKeyNodeHeaderSize || memcmp(node, "nk", 2) ||
+      ReadLE<uint16_t>(node + 0x48) > aSize - kKeyNodeHeaderSize) {
+    return nullptr;
+  }
+
+  return node;
+}
+
+std::optional<std::wstring> Hive::GetKeyName(const CellIndex aIndex) const {
+  uint32_t size;
+  const uint8_t *node = GetKeyNode(aIndex, size);
+  if (!node) {
+    return std::nullopt;
+  }
+
+  std::wstring name;
+  DecodeString(node + kKeyNodeHeaderSize, ReadLE<uint16_t>(node + 0x48),
+               ReadLE<uint16_t>(node + 0x02) & kKeyCompressedName, name);
+  return name;
+}
+
+HiveStatus Hive::ForEachSubKey(
+    const CellIndex aList, const int aDepth,
+    const std::function<void(CellIndex, std::optional<uint32_t>)> &aCallback)
+    const {
+  uint32_t size;
+  const uint8_t *list = GetCell(aList, size);
+  if (!list || size < 4 || aDepth > kMaxSubKeyListDepth) {
+    return HiveStatus::Corrupt;
+  }
+
+  const uint16_t count = ReadLE<uint16_t>(list + 2);
+  const uint8_t *items = list + 4;
+
+  // Index roots and index leaves hold bare cell indices.
+  const bool isRoot = !memcmp(list, "ri", 2);
+  if (isRoot || !memcmp(list, "li", 2)) {
+    if (count > (size - 4) / sizeof(uint32_t)) {
+      return HiveStatus::Corrupt;
+    }
+
+    for (uint16_t i = 0; i < count; ++i) {
+      const CellIndex item = ReadLE<uint32_t>(items + (i * sizeof(uint32_t)));
+      if (!isRoot) {
+        aCallback(item, std::nullopt);
+        continue;
+      }
+
+      HiveStatus status = ForEachSubKey(item, aDepth + 1, aCallback);
+      if (status != HiveStatus::Success) {
+        return status;
+      }
+    }
+
+    return HiveStatus::Success;
+  }
+
+  // Fast leaves and hash leaves pair each index with a hint.
+  const bool isHashLeaf = !memcmp(list, "lh", 2);
+  if (!isHashLeaf && memcmp(list, "lf", 2)) {
+    return HiveStatus::Corrupt;
+  }
+
+  if (count > (size - 4) / (2 * sizeof(uint32_t))) {
+    return HiveStatus::Corrupt;
+  }
+
+  for (uint16_t i = 0; i < count; ++i) {
+    const uint8_t *item = items + (i * 2 * sizeof(uint32_t));
+    std::optional<uint32_t> hash;
+    if (isHashLeaf) {
+      hash = ReadLE<uint32_t>(item + sizeof(uint32_t));
+    }
+
+    aCallback(ReadLE<uint32_t>(item), hash);
+  }
+
+  return HiveStatus::Success;
+}
+
+HiveStatus Hive::FindSubKey(const CellIndex aKey,
+                            const std::wstring_view &aName,
+                            CellIndex &aResult) const {
+  uint32_t size;
+  const uint8_t *node = GetKeyNode(aKey, size);
+  if (!node) {
+    return HiveStatus::Corrupt;
+  }
+
+  if (!ReadLE<uint32_t>(node + 0x14)) {
+    return HiveStatus::NotFound;
+  }
+
+  const std::optional<uint32_t> hash = HashKeyName(aName);
+
+  HiveStatus result = HiveStatus::NotFound;
+  HiveStatus status = ForEachSubKey(
+      ReadLE<uint32_t>(node + 0x1C), 0,
+      [this, &aName, &aResult, &hash,
+       &result](const CellIndex aSubKey, const std::optional<uint32_t> aHash) {
+        if (result == HiveStatus::Success ||
+            (hash && aHash && hash.value() != aHash.value())) {
+          return;
+        }
+
+        std::optional<std::wstring> name = GetKeyName(aSubKey);
+        if (name && NamesEqual(name.value(), aName)) {
+          aResult = aSubKey;
+          result = HiveStatus::Success;
+        }
+      });
+
+  if (result == HiveStatus::Success) {
+    return result;
+  }
+
+  return status == HiveStatus::Success ? result : status;
+}
+
+HiveStatus Hive::FindKey(const CellIndex aKey, const std::wstring_view &aPath,
+                         CellIndex &aResult) const {
+  CellIndex key = aKey;
+
+  std::wstring_view path(aPath);
+  while (!path.empty()) {
+    const size_t separator = path.find(L'\\');
+    const std::wstring_view component = path.substr(0, separator);
+    path = separator == std::wstring_view::npos ? std::wstring_view()
+                                                : path.substr(separator + 1);
+    if (component.empty()) {
+      continue;
+    }
+
+    HiveStatus status = FindSubKey(key, component, key);
+    if (status != HiveStatus::Success) {
+      return status;
+    }
+  }
+
+  aResult = key;
+  return HiveStatus::Success;
+}
+
+HiveStatus Hive::EnumSubKeys(
+    const CellIndex aKey,
+    const std::function<void(const std::wstring_view &)> &aCallback) const {
+  uint32_t size;
+  const uint8_t *node = GetKeyNode(aKey, size);
+  if (!node) {
+    return HiveStatus::Corrupt;
+  }
+
+  if (!ReadLE<uint32_t>(node + 0x14)) {
+    return HiveStatus::Success;
+  }
+
+  bool corrupt = false;
+  HiveStatus status = ForEachSubKey(
+      ReadLE<uint32_t>(node + 0x1C), 0,
+      [this, &aCallback, &corrupt](const CellIndex aSubKey,
+                                   const std::optional<uint32_t>) {
+        std::optional<std::wstring> name = GetKeyName(aSubKey);
+        if (!name) {
+          corrupt = true;
+          return;
+        }
+
+        aCallback(name.value());
+      });
+
+  if (status == HiveStatus::Success && corrupt) {
+    return HiveStatus::Corrupt;
+  }
+
+  return status;
+}
+
+HiveStatus Hive::FindValue(const CellIndex aKey, const std::wstring_view &aName,
+                           const uint8_t *&aValue) const {
+  uint32_t size;
+  const uint8_t *node = GetKeyNode(aKey, size);
+  if (!node) {
+    return HiveStatus::Corrupt;
+  }
+
+  const uint32_t numValues = ReadLE<uint32_t>(node + 0x24);
+  if (!numValues) {
+    return HiveStatus::NotFound;
+  }
+
+  const uint8_t *list = GetCell(ReadLE<uint32_t>(node + 0x28), size);
+  if (!list || numValues > size / sizeof(uint32_t)) {
+    return HiveStatus::Corrupt;
+  }
+
+  std::wstring name;
+  for (uint32_t i = 0; i < numValues; ++i) {
+    const uint8_t *value =
+        GetCell(ReadLE<uint32_t>(list + (i * sizeof(uint32_t))), size);
+    if (!value || size < kValueKeyHeaderSize || memcmp(value, "vk", 2)) {
+      return HiveStatus::Corrupt;
+    }
+
+    const uint16_t nameLen = ReadLE<uint16_t>(value + 0x02);
+    if (nameLen > size - kValueKeyHeaderSize) {
+      return HiveStatus::Corrupt;
+    }
+
+    DecodeString(value + kValueKeyHeaderSize, nameLen,
+                 ReadLE<uint16_t>(value + 0x10) & kValueCompressedName, name);
+    if (NamesEqual(name, aName)) {
+      aValue = value;
+      return HiveStatus::Success;
+    }
+  }
+
+  return HiveStatus::NotFound;
+}
+
+HiveStatus Hive::GetValueData(const uint8_t *aValue,
+                              std::vector<uint8_t> &aData) const {
+  const uint32_t dataSize = ReadLE<uint32_t>(aValue + 0x04);
+  const uint8_t *dataField = aValue + 0x08;
+
+  // Up to four bytes of data are stored in place of the data's cell index.
+  if (dataSize & kValueDataInline) {
+    const uint32_t inlineSize = dataSize & ~kValueDataInline;
+    if (inlineSize > sizeof(uint32_t)) {
+      return HiveStatus::Corrupt;
+    }
+
+    aData.assign(dataField, dataField + inlineSize);
+    return HiveStatus::Success;
+  }
+
+  if (!dataSize) {
+    aData.clear();
+    return HiveStatus::Success;
+  }
+
+  uint32_t size;
+  const uint8_t *data = GetCell(ReadLE<uint32_t>(dataField), size);
+  if (!data) {
+    return HiveStatus::Corrupt;
+  }
+
+  if (dataSize > kMaxBigDataSegmentSize &&
+      mMinorVersion >= kMinBigDataMinorVersion && size >= 8 &&
+      !memcmp(data, "db", 2)) {
+    const uint16_t numSegments = ReadLE<uint16_t>(data + 2);
+    const uint8_t *segments = GetCell(ReadLE<uint32_t>(data + 4), size);
+    if (!segments || numSegments > size / sizeof(uint32_t)) {
+      return HiveStatus::Corrupt;
+    }
+
+    aData.clear();
+    aData.reserve(dataSize);
+    for (uint16_t i = 0; i < numSegments && aData.size() < dataSize; ++i) {
+      const uint8_t *segment =
+          GetCell(ReadLE<uint32_t>(segments + (i * sizeof(uint32_t))), size);
+      if (!segment) {
+        return HiveStatus::Corrupt;
+      }
+
+      const size_t segmentSize =
+          std::min<size_t>({size, kMaxBigDataSegmentSize,
+                            dataSize - aData.size()});
+      aData.insert(aData.end(), segment, segment + segmentSize);
+    }
+
+    return aData.size() == dataSize ? HiveStatus::Success
+                                    : HiveStatus::Corrupt;
+  }
+
+  if (dataSize > size) {
+    return HiveStatus::Corrupt;
+  }
+
+  aData.assign(data, data + dataSize);
+  return HiveStatus::Success;
+}
+
+HiveStatus Hive::HasValue(const CellIndex aKey,
+                          const std::wstring_view &aName) const {
+  const uint8_t *value;
+  return FindValue(aKey, aName, value);
+}
+
+HiveStatus Hive::GetString(const CellIndex aKey, const std::wstring_view &aName,
+                           std::wstring &aValue) const {
+  const uint8_t *value;
+  HiveStatus status = FindValue(aKey, aName, value);
+  if (status != HiveStatus::Success) {
+    return status;
+  }
+
+  const uint32_t type = ReadLE<uint32_t>(value + 0x0C);
+  if (type != kRegSz && type != kRegExpandSz) {
+    return HiveStatus::WrongType;
+  }
+
+  std::vector<uint8_t> data;
+  status = GetValueData(value, data);
+  if (status != HiveStatus::Success) {
+    return status;
+  }
+
+  DecodeString(data.data(), data.size(), false, aValue);
+  return HiveStatus::Success;
+}
+
+} // namespace aptinfo
@@ -0,0 +1,128 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mappedfile.h"
+
+namespace aptinfo {
+
+enum class HiveStatus {
+  Success,
+  CannotOpen,
+  NotAHive,
+  Corrupt,
+  NotFound,
+  WrongType,
+};
+
+// Offset of a cell from the start of the hive bins data
+using CellIndex = uint32_t;
+
+// A read-only regf parser that works directly on a copy of a hive file,
+// without involving the Windows registry. Hives copied from a running system
+// are usually dirty: their most recent changes only exist in the .LOG1/.LOG2
+// transaction logs beside them. Those are replayed in memory onto a
+// copy-on-write mapping of the hive, so that pages which the logs do not touch
+// are shared with the file cache and neither file is ever modified.
+class Hive final {
+public:
+  static std::variant<Hive, HiveStatus>
+  Open(const std::filesystem::path &aPath);
+
+  // As above, but for a hive and logs that the caller has already read into
+  // memory. Logs that do not exist are simply omitted from aLogs.
+  static std::variant<Hive, HiveStatus>
+  FromBuffers(std::vector<uint8_t> &&aHive,
+              const std::vector<std::vector<uint8_t>> &aLogs);
+
+  static std::vector<std::filesystem::path>
+  GetLogPaths(const std::filesystem::path &aPath);
+
+  // Whether the base block's sequence numbers showed unflushed changes.
+  bool WasDirty() const { return mWasDirty; }
+  // The number of log entries (or, for old-style logs, whole logs) replayed.
+  uint32_t GetNumLogEntriesApplied() const { return mNumLogEntriesApplied; }
+
+  CellIndex GetRootKey() const { return mRootKey; }
+
+  // aPath is a backslash-separated path relative to aKey; an empty path
+  // refers to aKey itself. Names are matched case-insensitively.
+  HiveStatus FindKey(const CellIndex aKey, const std::wstring_view &aPath,
+                     CellIndex &aResult) const;
+  HiveStatus
+  EnumSubKeys(const CellIndex aKey,
+              const std::function<void(const std::wstring_view &)> &aCallback)
+      const;
+
+  // An empty aName refers to the key's default value.
+  HiveStatus HasValue(const CellIndex aKey,
+                      const std::wstring_view &aName) const;
+  // Accepts REG_SZ and REG_EXPAND_SZ. Environment variables are left
+  // unexpanded, since they refer to the machine that the hive came from.
+  HiveStatus GetString(const CellIndex aKey, const std::wstring_view &aName,
+                       std::wstring &aValue) const;
+
+  Hive(Hive &&) = default;
+  Hive(const Hive &) = delete;
+  Hive &operator=(const Hive &) = delete;
+  Hive &operator=(Hive &&) = delete;
+
+private:
+  using Storage = std::variant<MappedFile, std::vector<uint8_t>>;
+  // A log's contents and size
+  using LogView = std::pair<const uint8_t *, size_t>;
+
+  explicit Hive(Storage &&aStorage);
+
+  static std::variant<Hive, HiveStatus> Load(Hive &&aHive,
+                                             const std::vector<LogView> &aLogs);
+
+  size_t GetStorageSize() const;
+  bool ReadBaseBlock();
+  void ReplayLogs(const std::vector<LogView> &aLogs);
+  bool Reserve(const size_t aBinsSize);
+
+  const uint8_t *GetCell(const CellIndex aIndex, uint32_t &aSize) const;
+  const uint8_t *GetKeyNode(const CellIndex aIndex, uint32_t &aSize) const;
+  std::optional<std::wstring> GetKeyName(const CellIndex aIndex) const;
+  HiveStatus FindSubKey(const CellIndex aKey, const std::wstring_view &aName,
+                        CellIndex &aResult) const;
+  // The callback also receives the entry's name hash, when the list has one.
+  HiveStatus ForEachSubKey(
+      const CellIndex aList, const int aDepth,
+      const std::function<void(CellIndex, std::optional<uint32_t>)> &aCallback)
+      const;
+  HiveStatus FindValue(const CellIndex aKey, const std::wstring_view &aName,
+                       const uint8_t *&aValue) const;
+  HiveStatus GetValueData(const uint8_t *aValue,
+                          std::vector<uint8_t> &aData) const;
+
+private:
+  // Either the copy-on-write mapping of the hive, or a private copy of it:
+  // whether read by the caller, or because replaying the logs grew the hive
+  // past the end of the file.
+  Storage mStorage;
+  uint8_t *mData;
+  size_t mBinsSize;
+  uint32_t mMinorVersion;
+  CellIndex mRootKey;
+  bool mWasDirty;
+  uint32_t mNumLogEntriesApplied;
+};
+
+} // namespace aptinfo
@@ -0,0 +1,182 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "hiveingest.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+#include "batchreader.h"
+
+namespace aptinfo {
+
+// The hive itself, followed by its .LOG1 and .LOG2
+static constexpr uint64_t kFilesPerHive = 3;
+
+namespace {
+
+struct PendingHive final {
+  size_t mIndex;
+  std::optional<std::vector<uint8_t>> mHive;
+  std::vector<std::vector<uint8_t>> mLogs;
+  uint64_t mNumOutstanding;
+};
+
+} // anonymous namespace
+
+const char *IngestHives(const std::vector<std::filesystem::path> &aPaths,
+                        const IngestOptions &aOptions,
+                        const IngestCallback &aOnHive) {
+  std::unique_ptr<FileBatchReader> reader =
+      FileBatchReader::Create(aOptions.mQueueDepth);
+
+  const size_t maxInFlight = std::max(1U, aOptions.mMaxHivesInFlight);
+  const unsigned int numWorkers =
+      aOptions.mNumWorkers
+          ? aOptions.mNumWorkers
+          : std::max(1U, std::thread::hardware_concurrency());
+
+  // Everything below is shared with the workers.
+  std::mutex mutex;
+  std::condition_variable workAvailable;
+  std::condition_variable slotAvailable;
+  std::deque<PendingHive> loaded;
+  size_t numInFlight = 0;
+  bool done = false;
+
+  auto worker = [&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      workAvailable.wait(lock, [&]() { return done || !loaded.empty(); });
+      if (loaded.empty()) {
+        return;
+      }
+
+      std::optional<PendingHive> hive(std::move(loaded.front()));
+      loaded.pop_front();
+      lock.unlock();
+
+      if (hive->mHive) {
+        aOnHive(hive->mIndex,
+                Hive::FromBuffers(std::move(hive->mHive.value()),
+                                  hive->mLogs));
+      } else {
+        aOnHive(hive->mIndex, HiveStatus::CannotOpen);
+      }
+
+      // Free the buffers before admitting another hive in our place.
+      hive.reset();
+
+      lock.lock();
+      --numInFlight;
+      slotAvailable.notify_one();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned int i = 0; i < numWorkers; ++i) {
+    workers.emplace_back(worker);
+  }
+
+  // This thread only performs I/O, so that reads for later hives overlap
+  // with the classification of earlier ones.
+  std::unordered_map<size_t, PendingHive> reading;
+  size_t next = 0;
+  while (next < aPaths.size() || !reading.empty()) {
+    size_t first = next;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      // Block for a free slot only when there is nothing else to wait for.
+      if (reading.empty()) {
+        slotAvailable.wait(lock,
+                           [&]() { return numInFlight < maxInFlight; });
+      }
+
+      while (next < aPaths.size() && numInFlight < maxInFlight) {
+        ++numInFlight;
+        ++next;
+      }
+    }
+
+    for (; first < next; ++first) {
+      const std::vector<std::filesystem::path> logPaths =
+          Hive::GetLogPaths(aPaths[first]);
+      reading.emplace(first, PendingHive{first, std::nullopt, {},
+                                         1 + logPaths.size()});
+
+      const uint64_t tag = first * kFilesPerHive;
+      reader->Submit(tag, aPaths[first]);
+      for (size_t i = 0; i < logPaths.size(); ++i) {
+        reader->Submit(tag + 1 + i, logPaths[i]);
+      }
+    }
+
+    std::optional<FileReadResult> result = reader->WaitForCompletion();
+    if (!result) {
+      if (reading.empty()) {
+        continue;
+      }
+
+      // The reader has lost reads that it still owed us, and waiting again
+      // would spin forever. Fail every hive that we have not finished
+      // reading, rather than parsing one without all of its logs.
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto &[index, hive] : reading) {
+        loaded.push_back(PendingHive{index, std::nullopt, {}, 0});
+      }
+
+      for (; next < aPaths.size(); ++next) {
+        ++numInFlight;
+        loaded.push_back(PendingHive{next, std::nullopt, {}, 0});
+      }
+
+      reading.clear();
+      workAvailable.notify_all();
+      break;
+    }
+
+    const size_t index = static_cast<size_t>(result->mTag / kFilesPerHive);
+    PendingHive &hive = reading.at(index);
+    if (!(result->mTag % kFilesPerHive)) {
+      hive.mHive = std::move(result->mData);
+    } else if (result->mData) {
+      // Logs that do not exist are simply left out.
+      hive.mLogs.push_back(std::move(result->mData.value()));
+    }
+
+    if (--hive.mNumOutstanding) {
+      continue;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      loaded.push_back(std::move(hive));
+    }
+
+    reading.erase(index);
+    workAvailable.notify_one();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+  }
+
+  workAvailable.notify_all();
+  for (std::thread &thread : workers) {
+    thread.join();
+  }
+
+  return reader->GetName();
+}
+
+} // namespace aptinfo
@@ -0,0 +1,43 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <variant>
+#include <vector>
+
+#include <stddef.h>
+
+#include "hive.h"
+
+namespace aptinfo {
+
+struct IngestOptions final {
+  // Hives whose files are being read, or that are waiting for or undergoing
+  // classification. This bounds memory use, since each one is held entirely
+  // in memory.
+  unsigned int mMaxHivesInFlight = 16;
+  // Read requests outstanding at once, across every hive in flight
+  unsigned int mQueueDepth = 64;
+  // Zero for one per hardware thread
+  unsigned int mNumWorkers = 0;
+};
+
+using IngestCallback =
+    std::function<void(size_t, std::variant<Hive, HiveStatus> &&)>;
+
+// Reads each hive in aPaths, along with its transaction logs, using large
+// batched reads, while already loaded hives are parsed and handed to
+// aOnHive. aOnHive receives the hive's index within aPaths; it is invoked
+// concurrently from worker threads, in whatever order the reads complete.
+// Returns the name of the I/O mechanism that was used.
+const char *IngestHives(const std::vector<std::filesystem::path> &aPaths,
+                        const IngestOptions &aOptions,
+                        const IngestCallback &aOnHive);
+
+} // namespace aptinfo
@@ -0,0 +1,107 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "mappedfile.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // defined(_WIN32)
+
+namespace aptinfo {
+
+#if defined(_WIN32)
+
+std::optional<MappedFile> MappedFile::Open(const std::filesystem::path &aPath,
+                                           const Access aAccess) {
+  HANDLE file = ::CreateFileW(aPath.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return std::nullopt;
+  }
+
+  LARGE_INTEGER size;
+  if (!::GetFileSizeEx(file, &size) || !size.QuadPart ||
+      static_cast<ULONGLONG>(size.QuadPart) > SIZE_MAX) {
+    ::CloseHandle(file);
+    return std::nullopt;
+  }
+
+  const bool copyOnWrite = aAccess == Access::CopyOnWrite;
+  HANDLE mapping = ::CreateFileMappingW(
+      file, nullptr, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0,
+      nullptr);
+  ::CloseHandle(file);
+  if (!mapping) {
+    return std::nullopt;
+  }
+
+  // The view keeps the mapping alive.
+  void *view = ::MapViewOfFile(
+      mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+  ::CloseHandle(mapping);
+  if (!view) {
+    return std::nullopt;
+  }
+
+  return MappedFile(static_cast<uint8_t *>(view),
+                    static_cast<size_t>(size.QuadPart), aAccess);
+}
+
+MappedFile::~MappedFile() {
+  if (mData) {
+    ::UnmapViewOfFile(mData);
+  }
+}
+
+#else
+
+std::optional<MappedFile> MappedFile::Open(const std::filesystem::path &aPath,
+                                           const Access aAccess) {
+  int fd = ::open(aPath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+
+  struct stat st;
+  if (::fstat(fd, &st) || st.st_size <= 0) {
+    ::close(fd);
+    return std::nullopt;
+  }
+
+  const size_t size = static_cast<size_t>(st.st_size);
+  // MAP_PRIVATE already gives us copy-on-write semantics.
+  const int prot =
+      aAccess == Access::CopyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ;
+  void *view = ::mmap(nullptr, size, prot, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (view == MAP_FAILED) {
+    return std::nullopt;
+  }
+
+  return MappedFile(static_cast<uint8_t *>(view), size, aAccess);
+}
+
+MappedFile::~MappedFile() {
+  if (mData) {
+    ::munmap(mData, mSize);
+  }
+}
+
+#endif // defined(_WIN32)
+
+MappedFile::MappedFile(MappedFile &&aOther)
+    : mData(aOther.mData), mSize(aOther.mSize), mAccess(aOther.mAccess) {
+  aOther.mData = nullptr;
+  aOther.mSize = 0;
+}
+
+} // namespace aptinfo
@@ -0,0 +1,59 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <filesystem>
+#include <optional>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace aptinfo {
+
+// A read-only view of an entire file. This is deliberately free of any
+// Windows dependencies so that offline analysis also works on other hosts.
+class MappedFile final {
+public:
+  enum class Access {
+    ReadOnly,
+    // Pages may be modified in memory, but the first write to each page gives
+    // us a private copy of it. Nothing is ever written back to the file.
+    CopyOnWrite,
+  };
+
+  static std::optional<MappedFile>
+  Open(const std::filesystem::path &aPath,
+       const Access aAccess = Access::ReadOnly);
+
+  ~MappedFile();
+
+  const uint8_t *GetData() const { return mData; }
+  size_t GetSize() const { return mSize; }
+
+  // Only valid for Access::CopyOnWrite mappings.
+  uint8_t *GetWritableData() const {
+    assert(mAccess == Access::CopyOnWrite);
+    return mData;
+  }
+
+  MappedFile(MappedFile &&aOther);
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  MappedFile &operator=(MappedFile &&) = delete;
+
+private:
+  MappedFile(uint8_t *aData, const size_t aSize, const Access aAccess)
+      : mData(aData), mSize(aSize), mAccess(aAccess) {}
+
+private:
+  uint8_t *mData;
+  size_t mSize;
+  Access mAccess;
+};
+
+} // namespace aptinfo
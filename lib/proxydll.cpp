@@ -0,0 +1,454 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "proxydll.h"
+
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include <system_error>
+#include <thread>
+#include <unordered_set>
+
+#include "byteorder.h"
+#include "mappedfile.h"
+
+namespace aptinfo {
+
+// MIDL never emits more interfaces than this into a single ProxyFileInfo;
+// anything larger is a false positive.
+static constexpr uint16_t kMaxTableSize = 4096;
+static constexpr uint16_t kMaxTableVersion = 16;
+static constexpr size_t kMaxInterfaceNameLen = 255;
+static constexpr uint32_t kImageScnCntInitializedData = 0x00000040;
+
+namespace {
+
+// Just enough of a PE parser to translate the absolute addresses stored in a
+// DLL's initialized data back into offsets within the file.
+class PortableExecutable final {
+public:
+  static std::optional<PortableExecutable> Parse(const uint8_t *aData,
+                                                 const size_t aSize);
+
+  size_t GetPointerSize() const { return mPointerSize; }
+
+  // Returns null when [aVa, aVa + aLen) is not backed by the file.
+  const uint8_t *Resolve(const uint64_t aVa, const size_t aLen) const;
+
+  std::optional<uint64_t> ReadPointer(const uint8_t *aPtr) const {
+    if (aPtr < mData || aPtr + mPointerSize > mData + mSize) {
+      return std::nullopt;
+    }
+
+    return mPointerSize == sizeof(uint64_t)
+               ? ReadLE<uint64_t>(aPtr)
+               : static_cast<uint64_t>(ReadLE<uint32_t>(aPtr));
+  }
+
+  // Only visits sections of initialized data, which is where MIDL places
+  // its tables.
+  template <typename CallbackT>
+  void ForEachDataSection(CallbackT &&aCallback) const {
+    for (const Section &section : mSections) {
+      if (section.mCharacteristics & kImageScnCntInitializedData) {
+        aCallback(mData + section.mFileOffset, section.mFileSize);
+      }
+    }
+  }
+
+private:
+  struct Section final {
+    uint32_t mRva;
+    uint32_t mVirtualSize;
+    uint32_t mFileOffset;
+    uint32_t mFileSize;
+    uint32_t mCharacteristics;
+  };
+
+  PortableExecutable(const uint8_t *aData, const size_t aSize,
+                     const size_t aPointerSize, const uint64_t aImageBase,
+                     std::vector<Section> &&aSections)
+      : mData(aData), mSize(aSize), mPointerSize(aPointerSize),
+        mImageBase(aImageBase), mSections(std::move(aSections)) {}
+
+private:
+  const uint8_t *mData;
+  size_t mSize;
+  size_t mPointerSize;
+  uint64_t mImageBase;
+  std::vector<Section> mSections;
+};
+
+} // anonymous namespace
+
+std::optional<PortableExecutable>
+PortableExecutable::Parse(const uint8_t *aData, const size_t aSize) {
+  constexpr size_t kDosHeaderSize = 0x40;
+  constexpr size_t kNtSignatureSize = 4;
+  constexpr size_t kFileHeaderSize = 20;
+  constexpr size_t kSectionHeaderSize = 40;
+  constexpr uint16_t kPe32Magic = 0x10B;
+  constexpr uint16_t kPe32PlusMagic = 0x20B;
+
+  if (aSize < kDosHeaderSize || aData[0] != 'M' || aData[1] != 'Z') {
+    return std::nullopt;
+  }
+
+  const size_t ntOffset = ReadLE<uint32_t>(aData + 0x3C);
+  if (ntOffset > aSize - kNtSignatureSize - kFileHeaderSize ||
+      memcmp(aData + ntOffset, "PE\0\0", kNtSignatureSize)) {
+    return std::nullopt;
+  }
+
+  const uint8_t *fileHeader = aData + ntOffset + kNtSignatureSize;
+  const uint16_t numSections = ReadLE<uint16_t>(fileHeader + 2);
+  const uint16_t optionalHeaderSize = ReadLE<uint16_t>(fileHeader + 16);
+
+  const size_t optionalHeaderOffset =
+      ntOffset + kNtSignatureSize + kFileHeaderSize;
+  const size_t sectionsOffset = optionalHeaderOffset + optionalHeaderSize;
+  if (optionalHeaderSize < 32 ||
+      sectionsOffset + (numSections * kSectionHeaderSize) > aSize) {
+    return std::nullopt;
+  }
+
+  const uint8_t *optionalHeader = aData + optionalHeaderOffset;
+  size_t pointerSize;
+  uint64_t imageBase;
+  switch (ReadLE<uint16_t>(optionalHeader)) {
+  case kPe32Magic:
+    pointerSize = sizeof(uint32_t);
+    imageBase = ReadLE<uint32_t>(optionalHeader + 28);
+    break;
+  case kPe32PlusMagic:
+    pointerSize = sizeof(uint64_t);
+    imageBase = ReadLE<uint64_t>(optionalHeader + 24);
+    break;
+  default:
+    return std::nullopt;
+  }
+
+  std::vector<Section> sections;
+  sections.reserve(numSections);
+  for (uint16_t i = 0; i < numSections; ++i) {
+    const uint8_t *header = aData + sectionsOffset + (i * kSectionHeaderSize);
+    Section section{ReadLE<uint32_t>(header + 12),
+                    ReadLE<uint32_t>(header + 8),
+                    ReadLE<uint32_t>(header + 20),
+                    ReadLE<uint32_t>(header + 16),
+                    ReadLE<uint32_t>(header + 36)};
+    if (section.mFileOffset >= aSize) {
+      continue;
+    }
+
+    // SizeOfRawData is rounded up to the file alignment, so anything past
+    // VirtualSize is padding rather than part of the section. Some linkers
+    // leave VirtualSize zero, in which case the raw size is all we have.
+    if (section.mVirtualSize) {
+      section.mFileSize = std::min(section.mFileSize, section.mVirtualSize);
+    }
+
+    // Truncated images still get whatever part of the section is present.
+    section.mFileSize = static_cast<uint32_t>(
+        std::min<size_t>(section.mFileSize, aSize - section.mFileOffset));
+    sections.push_back(section);
+  }
+
+  return PortableExecutable(aData, aSize, pointerSize, imageBase,
+                            std::move(sections));
+}
+
+const uint8_t *PortableExecutable::Resolve(const uint64_t aVa,
+                                           const size_t aLen) const {
+  if (aVa < mImageBase) {
+    return nullptr;
+  }
+
+  const uint64_t rva = aVa - mImageBase;
+  for (const Section &section : mSections) {
+    if (rva < section.mRva) {
+      continue;
+    }
+
+    // Parse already clamps every section to the mapping, but the pointers
+    // that we resolve come straight from the file, so nothing here may
+    // overflow.
+    if (section.mFileOffset > mSize ||
+        section.mFileSize > mSize - section.mFileOffset) {
+      continue;
+    }
+
+    // Only the portion of the section that is backed by the file is useful
+    // to us; the remainder is zero-filled at load time.
+    const uint64_t offsetInSection = rva - section.mRva;
+    if (aLen <= section.mFileSize &&
+        offsetInSection <= section.mFileSize - aLen) {
+      return mData + section.mFileOffset + offsetInSection;
+    }
+  }
+
+  return nullptr;
+}
+
+static std::optional<std::string>
+ReadInterfaceName(const PortableExecutable &aImage, const uint64_t aVa) {
+  const uint8_t *name = aImage.Resolve(aVa, 1);
+  if (!name) {
+    return std::nullopt;
+  }
+
+  std::string result;
+  for (size_t i = 0; i <= kMaxInterfaceNameLen; ++i) {
+    if (!aImage.Resolve(aVa + i, 1)) {
+      return std::nullopt;
+    }
+
+    const char c = static_cast<char>(name[i]);
+    if (!c) {
+      if (result.empty()) {
+        return std::nullopt;
+      }
+
+      return result;
+    }
+
+    // MIDL interface names are C identifiers.
+    if (!(c == '_' || (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+          (c >= 'a' && c <= 'z'))) {
+      return std::nullopt;
+    }
+
+    result.push_back(c);
+  }
+
+  return std::nullopt;
+}
+
+// Attempts to interpret aCandidate as a MIDL ProxyFileInfo:
+//
+//   const PCInterfaceProxyVtblList *pProxyVtblList;
+//   const PCInterfaceStubVtblList  *pStubVtblList;
+//   const PCInterfaceName          *pNamesArray;
+//   const IID                     **pDelegatedIIDs;
+//   const PIIDLookup                pIIDLookupRtn;
+//   unsigned short                  TableSize;
+//   unsigned short                  TableVersion;
+//   const IID                     **pAsyncIIDLookup;
+//   LONG_PTR                        Filler2;
+//   LONG_PTR                        Filler3;
+//   LONG_PTR                        Filler4;
+//
+// Each entry of pStubVtblList points at a CInterfaceStubHeader, which begins
+// with the interface's IID pointer. Both lists are null-terminated.
+static bool ReadProxyFileInfo(const PortableExecutable &aImage,
+                              const uint8_t *aCandidate, const size_t aAvail,
+                              std::vector<ProxiedInterface> &aInterfaces) {
+  const size_t ptrSize = aImage.GetPointerSize();
+  const size_t tableSizeOffset = 5 * ptrSize;
+  const size_t asyncOffset = 6 * ptrSize;
+  const size_t structSize = asyncOffset + (4 * ptrSize);
+  if (aAvail < structSize) {
+    return false;
+  }
+
+  // Cheapest checks first, since nearly every candidate fails them.
+  const uint16_t tableSize = ReadLE<uint16_t>(aCandidate + tableSizeOffset);
+  const uint16_t tableVersion =
+      ReadLE<uint16_t>(aCandidate + tableSizeOffset + 2);
+  if (!tableSize || tableSize > kMaxTableSize || !tableVersion ||
+      tableVersion > kMaxTableVersion) {
+    return false;
+  }
+
+  for (size_t filler = 1; filler <= 3; ++filler) {
+    if (aImage.ReadPointer(aCandidate + asyncOffset + (filler * ptrSize))
+            .value_or(1)) {
+      return false;
+    }
+  }
+
+  const uint64_t proxyList = aImage.ReadPointer(aCandidate).value_or(0);
+  const uint64_t stubList =
+      aImage.ReadPointer(aCandidate + ptrSize).value_or(0);
+  const uint64_t namesArray =
+      aImage.ReadPointer(aCandidate + (2 * ptrSize)).value_or(0);
+  if (!proxyList || !stubList || !namesArray) {
+    return false;
+  }
+
+  const size_t listLen = (tableSize + 1) * ptrSize;
+  const uint8_t *stubs = aImage.Resolve(stubList, listLen);
+  const uint8_t *names = aImage.Resolve(namesArray, listLen);
+  if (!stubs || !names || !aImage.Resolve(proxyList, listLen) ||
+      aImage.ReadPointer(stubs + (tableSize * ptrSize)).value_or(1) ||
+      aImage.ReadPointer(names + (tableSize * ptrSize)).value_or(1)) {
+    return false;
+  }
+
+  std::vector<ProxiedInterface> found;
+  found.reserve(tableSize);
+  for (size_t i = 0; i < tableSize; ++i) {
+    const uint8_t *stubHeader =
+        aImage.Resolve(aImage.ReadPointer(stubs + (i * ptrSize)).value_or(0),
+                       ptrSize);
+    if (!stubHeader) {
+      return false;
+    }
+
+    const uint8_t *iid = aImage.Resolve(
+        aImage.ReadPointer(stubHeader).value_or(0), sizeof(RawGuid));
+    if (!iid) {
+      return false;
+    }
+
+    std::optional<std::string> name = ReadInterfaceName(
+        aImage, aImage.ReadPointer(names + (i * ptrSize)).value_or(0));
+    if (!name) {
+      return false;
+    }
+
+    ProxiedInterface entry{{}, std::move(name.value())};
+    memcpy(&entry.mIid, iid, sizeof(RawGuid));
+    found.push_back(std::move(entry));
+  }
+
+  aInterfaces.insert(aInterfaces.end(),
+                     std::make_move_iterator(found.begin()),
+                     std::make_move_iterator(found.end()));
+  return true;
+}
+
+std::variant<ProxyDllInfo, ProxyDllStatus>
+AnalyzeProxyDll(const std::filesystem::path &aPath) {
+  std::optional<MappedFile> file = MappedFile::Open(aPath);
+  if (!file) {
+    return ProxyDllStatus::CannotOpen;
+  }
+
+  std::optional<PortableExecutable> image =
+      PortableExecutable::Parse(file->GetData(), file->GetSize());
+  if (!image) {
+    return ProxyDllStatus::NotPortableExecutable;
+  }
+
+  ProxyDllInfo info{aPath, {}};
+
+  // A DLL built from several IDL files has one ProxyFileInfo per file. The
+  // tables are pointer-aligned, so that is our stride.
+  const size_t ptrSize = image->GetPointerSize();
+  image->ForEachDataSection([&](const uint8_t *aSection, const size_t aSize) {
+    for (size_t offset = 0; offset + ptrSize <= aSize; offset += ptrSize) {
+      ReadProxyFileInfo(image.value(), aSection + offset, aSize - offset,
+                        info.mInterfaces);
+    }
+  });
+
+  if (info.mInterfaces.empty()) {
+    return ProxyDllStatus::NoProxyFileInfo;
+  }
+
+  // The same interface may be listed by more than one table.
+  std::unordered_set<RawGuid, RawGuidHash> seen;
+  info.mInterfaces.erase(
+      std::remove_if(info.mInterfaces.begin(), info.mInterfaces.end(),
+                     [&seen](const ProxiedInterface &aEntry) {
+                       return !seen.insert(aEntry.mIid).second;
+                     }),
+      info.mInterfaces.end());
+
+  return info;
+}
+
+std::variant<std::vector<ProxyDllInfo>, ProxyDllStatus>
+AnalyzeProxyDllDirectory(const std::filesystem::path &aDir,
+                         unsigned int aNumThreads) {
+  std::vector<std::filesystem::path> paths;
+
+  std::error_code ec;
+  for (std::filesystem::directory_iterator itr(aDir, ec), end;
+       !ec && itr != end; itr.increment(ec)) {
+    std::filesystem::path extension(itr->path().extension());
+    std::string strExtension(extension.string());
+    std::transform(strExtension.begin(), strExtension.end(),
+                   strExtension.begin(), [](const char aChar) {
+                     return static_cast<char>(
+                         (aChar >= 'A' && aChar <= 'Z') ? aChar - 'A' + 'a'
+                                                        : aChar);
+                   });
+    if (strExtension == ".dll" && itr->is_regular_file(ec)) {
+      paths.push_back(itr->path());
+    }
+  }
+
+  if (ec) {
+    return ProxyDllStatus::CannotOpen;
+  }
+
+  if (!aNumThreads) {
+    aNumThreads = std::max(1U, std::thread::hardware_concurrency());
+  }
+
+  aNumThreads =
+      static_cast<unsigned int>(std::min<size_t>(aNumThreads, paths.size()));
+
+  // Each worker claims the next unanalyzed DLL until none remain, so a few
+  // large DLLs cannot hold up the rest of the directory.
+  std::vector<std::optional<ProxyDllInfo>> results(paths.size());
+  std::atomic<size_t> next(0);
+  auto worker = [&paths, &results, &next]() {
+    for (size_t i = next++; i < paths.size(); i = next++) {
+      std::variant<ProxyDllInfo, ProxyDllStatus> result =
+          AnalyzeProxyDll(paths[i]);
+      if (std::holds_alternative<ProxyDllInfo>(result)) {
+        results[i].emplace(std::move(std::get<ProxyDllInfo>(result)));
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned int i = 1; i < aNumThreads; ++i) {
+    threads.emplace_back(worker);
+  }
+
+  worker();
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  std::vector<ProxyDllInfo> dlls;
+  for (std::optional<ProxyDllInfo> &result : results) {
+    if (result) {
+      dlls.push_back(std::move(result.value()));
+    }
+  }
+
+  return dlls;
+}
+
+ProxyDllIndex::ProxyDllIndex(std::vector<ProxyDllInfo> &&aDlls)
+    : mDlls(std::move(aDlls)) {
+  for (size_t dll = 0; dll < mDlls.size(); ++dll) {
+    const std::vector<ProxiedInterface> &interfaces = mDlls[dll].mInterfaces;
+    for (size_t entry = 0; entry < interfaces.size(); ++entry) {
+      mByIid.emplace(interfaces[entry].mIid, std::make_pair(dll, entry));
+    }
+  }
+}
+
+void ProxyDllIndex::Lookup(
+    const RawGuid &aIid,
+    const std::function<void(const ProxyDllInfo &, const ProxiedInterface &)>
+        &aCallback) const {
+  auto [begin, end] = mByIid.equal_range(aIid);
+  for (auto itr = begin; itr != end; ++itr) {
+    const ProxyDllInfo &dll = mDlls[itr->second.first];
+    aCallback(dll, dll.mInterfaces[itr->second.second]);
+  }
+}
+
+} // namespace aptinfo
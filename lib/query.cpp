@@ -0,0 +1,245 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "aptinfo.h"
+
+#include <comdef.h>
+
+#include "apartment.h"
+#include "utils.h"
+
+using namespace ::std::literals::string_view_literals;
+
+namespace aptinfo {
+
+std::optional<LONG>
+ClassReport::GetResult(const DiagnosticStep aStep) const {
+  for (auto itr = mDiagnostics.rbegin(); itr != mDiagnostics.rend(); ++itr) {
+    if (itr->mStep == aStep) {
+      return itr->mCode;
+    }
+  }
+
+  return std::nullopt;
+}
+
+static std::variant<ComClassThreadInfo, LSTATUS>
+GetClassThreadingModel(const ClassStore &aStore,
+                       const std::wstring_view &aStrClsid,
+                       const DiagnosticStep aThreadingModelStep,
+                       const DiagnosticStep aServerPathStep,
+                       std::wstring &aServerPath, Diagnostics &aDiagnostics) {
+  std::wstring subKeyInprocServer(L"CLSID\\"sv);
+  subKeyInprocServer += aStrClsid;
+  subKeyInprocServer += L"\\InprocServer32"sv;
+
+  std::wstring threadingModel;
+  LSTATUS result =
+      aStore.GetString(subKeyInprocServer, L"ThreadingModel", threadingModel);
+  aDiagnostics.push_back({aThreadingModelStep, result});
+  if (result == ERROR_FILE_NOT_FOUND) {
+    // Check if the subkey exists, at least. If not, the class is not
+    // registered at all. If it is registered, then we're just missing the
+    // ThreadingModel registry value.
+    if (aStore.HasKey(subKeyInprocServer) != ERROR_SUCCESS) {
+      return result;
+    }
+  } else if (result != ERROR_SUCCESS) {
+    return result;
+  }
+
+  LSTATUS pathResult =
+      aStore.GetString(subKeyInprocServer, nullptr, aServerPath);
+  aDiagnostics.push_back({aServerPathStep, pathResult});
+
+  // Empty or non-existent ThreadingModel implies STA.
+  if (result == ERROR_FILE_NOT_FOUND || threadingModel.empty() ||
+      !_wcsicmp(threadingModel.c_str(), L"Apartment")) {
+    return ComClassThreadInfo{ThreadingModel::STA, Provenance::Registry};
+  }
+
+  if (!_wcsicmp(threadingModel.c_str(), L"Free")) {
+    return ComClassThreadInfo{ThreadingModel::MTA, Provenance::Registry};
+  }
+
+  if (!_wcsicmp(threadingModel.c_str(), L"Both")) {
+    return ComClassThreadInfo{ThreadingModel::Both, Provenance::Registry};
+  }
+
+  if (!_wcsicmp(threadingModel.c_str(), L"Neutral")) {
+    return ComClassThreadInfo{ThreadingModel::Neutral, Provenance::Registry};
+  }
+
+  return static_cast<LSTATUS>(ERROR_UNIDENTIFIED_ERROR);
+}
+
+static std::optional<SurrogateInfo>
+GetSurrogate(const ClassResolver &aResolver, const std::wstring_view &aStrClsid,
+             Diagnostics &aDiagnostics) {
+  std::wstring subKeyClsid(L"CLSID\\"sv);
+  subKeyClsid += aStrClsid;
+
+  std::wstring appID;
+  LSTATUS result =
+      aResolver.GetStore().GetString(subKeyClsid, L"AppID", appID);
+  aDiagnostics.push_back({DiagnosticStep::ReadAppID, result});
+  if (result != ERROR_SUCCESS) {
+    return std::nullopt;
+  }
+
+  // Many classes share each AppID, so the AppID itself is memoized.
+  return aResolver.ResolveSurrogate(appID, aDiagnostics);
+}
+
+ProxyInfo QueryProxy(const ClassStore &aStore, REFIID aIid,
+                     Diagnostics &aDiagnostics) {
+  ProxyInfo info;
+
+  wchar_t strIid[kGuidLenWithBracesInclNul] = {};
+  ::StringFromGUID2(aIid, strIid, static_cast<int>(ArrayLength(strIid)));
+
+  std::wstring subKeyProxyStubClsid(L"Interface\\"sv);
+  subKeyProxyStubClsid += BufToView(strIid);
+  subKeyProxyStubClsid += L"\\ProxyStubClsid32"sv;
+
+  std::wstring strProxyStubClsid;
+  LSTATUS result =
+      aStore.GetString(subKeyProxyStubClsid, nullptr, strProxyStubClsid);
+  aDiagnostics.push_back({DiagnosticStep::ReadProxyStubClsid, result});
+  if (result != ERROR_SUCCESS) {
+    return info;
+  }
+
+  CLSID proxyStubClsid;
+  HRESULT hr = ::CLSIDFromString(strProxyStubClsid.c_str(), &proxyStubClsid);
+  aDiagnostics.push_back({DiagnosticStep::ParseProxyStubClsid, hr});
+  if (FAILED(hr)) {
+    return info;
+  }
+
+  info.mProxyStubClsid = proxyStubClsid;
+
+  std::variant<ComClassThreadInfo, LSTATUS> proxyModel = GetClassThreadingModel(
+      aStore, strProxyStubClsid, DiagnosticStep::ReadProxyThreadingModel,
+      DiagnosticStep::ReadProxyServerPath, info.mServerPath, aDiagnostics);
+  if (std::holds_alternative<ComClassThreadInfo>(proxyModel)) {
+    info.mThreadInfo.emplace(std::get<ComClassThreadInfo>(proxyModel));
+  }
+
+  return info;
+}
+
+ClassReport QueryClass(const ClassStore &aStore, REFCLSID aClsid,
+                       const std::optional<IID> &aOptIid,
+                       const QueryMode aMode) {
+  ClassResolver resolver(aStore);
+  return QueryClass(resolver, aClsid, aOptIid, aMode);
+}
+
+ClassReport QueryClass(const ClassResolver &aResolver, REFCLSID aClsid,
+                       const std::optional<IID> &aOptIid,
+                       const QueryMode aMode) {
+  const ClassStore &store = aResolver.GetStore();
+  ClassReport report(aClsid);
+
+  // COM activates the emulating class in place of aClsid, so that is the
+  // class whose registration we must examine. Should the emulation be
+  // broken, COM falls back to aClsid itself, and so do we.
+  CLSID effectiveClsid = aClsid;
+  std::variant<CLSID, LSTATUS> treatAs = aResolver.ResolveTreatAs(aClsid);
+  if (std::holds_alternative<CLSID>(treatAs)) {
+    report.mDiagnostics.push_back(
+        {DiagnosticStep::ResolveTreatAs, ERROR_SUCCESS});
+    effectiveClsid = std::get<CLSID>(treatAs);
+    if (effectiveClsid != aClsid) {
+      report.mTreatAs = effectiveClsid;
+    }
+  } else {
+    report.mDiagnostics.push_back(
+        {DiagnosticStep::ResolveTreatAs, std::get<LSTATUS>(treatAs)});
+  }
+
+  wchar_t strClsidBuf[kGuidLenWithBracesInclNul] = {};
+  ::StringFromGUID2(effectiveClsid, strClsidBuf,
+                    static_cast<int>(ArrayLength(strClsidBuf)));
+  const std::wstring_view strClsid(BufToView(strClsidBuf));
+
+  const bool canInstantiate = aMode == QueryMode::Full && store.IsSystem();
+
+  std::variant<ComClassThreadInfo, LSTATUS> inprocModel =
+      GetClassThreadingModel(store, strClsid,
+                             DiagnosticStep::ReadThreadingModel,
+                             DiagnosticStep::ReadServerPath,
+                             report.mServerPath, report.mDiagnostics);
+  if (std::holds_alternative<ComClassThreadInfo>(inprocModel)) {
+    report.mServerKind = ServerKind::InprocServer;
+
+    const ComClassThreadInfo &registryInfo =
+        std::get<ComClassThreadInfo>(inprocModel);
+    if (canInstantiate) {
+      report.mThreadInfo.emplace(registryInfo.CheckObjectCapabilities(
+          aClsid, aOptIid, report.mDiagnostics));
+    } else {
+      report.mThreadInfo.emplace(registryInfo);
+    }
+
+    report.mSurrogate =
+        GetSurrogate(aResolver, strClsid, report.mDiagnostics);
+    if (report.mSurrogate && aOptIid.has_value()) {
+      report.mProxy.emplace(
+          aResolver.ResolveProxy(aOptIid.value(), report.mDiagnostics));
+    }
+
+    return report;
+  }
+
+  if (std::get<LSTATUS>(inprocModel) != ERROR_FILE_NOT_FOUND) {
+    return report;
+  }
+
+  std::wstring subKeyLocalServer(L"CLSID\\"sv);
+  subKeyLocalServer += strClsid;
+  subKeyLocalServer += L"\\LocalServer32"sv;
+
+  LSTATUS result = store.HasKey(subKeyLocalServer);
+  report.mDiagnostics.push_back({DiagnosticStep::OpenLocalServer, result});
+  if (result == ERROR_FILE_NOT_FOUND && canInstantiate) {
+    // Try querying for a class object that might have been registered at
+    // runtime. We need to enter an apartment before calling CoGetClassObject.
+    RunInApartment(ThreadingModel::MTA, [&](const Apartment &aApt) {
+      report.mDiagnostics.push_back(
+          {DiagnosticStep::EnterClassObjectApartment, aApt.GetHResult()});
+      if (!aApt) {
+        return;
+      }
+
+      IClassFactoryPtr classFactory;
+      HRESULT hr = ::CoGetClassObject(
+          aClsid, CLSCTX_LOCAL_SERVER, nullptr, IID_IClassFactory,
+          reinterpret_cast<void **>(
+              static_cast<IClassFactory **>(&classFactory)));
+      report.mDiagnostics.push_back({DiagnosticStep::GetClassObject, hr});
+    });
+
+    std::optional<LONG> classObjectResult =
+        report.GetResult(DiagnosticStep::GetClassObject);
+    if (!classObjectResult || FAILED(classObjectResult.value())) {
+      return report;
+    }
+  } else if (result != ERROR_SUCCESS) {
+    return report;
+  }
+
+  report.mServerKind = ServerKind::LocalServer;
+  if (aOptIid.has_value()) {
+    report.mProxy.emplace(
+        aResolver.ResolveProxy(aOptIid.value(), report.mDiagnostics));
+  }
+
+  return report;
+}
+
+} // namespace aptinfo
@@ -0,0 +1,133 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "aptinfo.h"
+
+#include <algorithm>
+
+#include "utils.h"
+
+using namespace ::std::literals::string_view_literals;
+
+namespace aptinfo {
+
+std::variant<std::optional<CLSID>, LSTATUS>
+ClassResolver::ReadTreatAs(REFCLSID aClsid) const {
+  wchar_t strClsid[kGuidLenWithBracesInclNul] = {};
+  ::StringFromGUID2(aClsid, strClsid, static_cast<int>(ArrayLength(strClsid)));
+
+  std::wstring subKeyClsid(L"CLSID\\"sv);
+  subKeyClsid += BufToView(strClsid);
+
+  // AutoTreatAs is the emulation that COM restores whenever TreatAs is
+  // reset, so it only matters when TreatAs is absent.
+  for (const std::wstring_view &edge : {L"\\TreatAs"sv, L"\\AutoTreatAs"sv}) {
+    std::wstring subKeyEdge(subKeyClsid);
+    subKeyEdge += edge;
+
+    std::wstring strTarget;
+    LSTATUS result = mStore.GetString(subKeyEdge, nullptr, strTarget);
+    if (result == ERROR_FILE_NOT_FOUND) {
+      continue;
+    }
+
+    if (result != ERROR_SUCCESS) {
+      return result;
+    }
+
+    CLSID target;
+    if (FAILED(::CLSIDFromString(strTarget.c_str(), &target))) {
+      return static_cast<LSTATUS>(ERROR_INVALID_DATA);
+    }
+
+    // Emulating CLSID_NULL, or oneself, is how emulation is switched off.
+    if (target == CLSID_NULL || target == aClsid) {
+      return std::nullopt;
+    }
+
+    return target;
+  }
+
+  return std::nullopt;
+}
+
+std::variant<CLSID, LSTATUS>
+ClassResolver::ResolveTreatAs(REFCLSID aClsid) const {
+  // Each link is read from the registry only once, however many chains pass
+  // through it. Walking the memoized links is cheap, so we detect cycles
+  // here rather than memoizing whole chains.
+  std::vector<CLSID> chain;
+  CLSID current = aClsid;
+
+  while (true) {
+    if (std::find(chain.begin(), chain.end(), current) != chain.end()) {
+      return static_cast<LSTATUS>(ERROR_CIRCULAR_DEPENDENCY);
+    }
+
+    chain.push_back(current);
+
+    std::variant<std::optional<CLSID>, LSTATUS> next = mTreatAs.GetOrCompute(
+        current, [this, &current]() { return ReadTreatAs(current); });
+    if (std::holds_alternative<LSTATUS>(next)) {
+      return std::get<LSTATUS>(next);
+    }
+
+    const std::optional<CLSID> &target = std::get<std::optional<CLSID>>(next);
+    if (!target) {
+      return current;
+    }
+
+    current = target.value();
+  }
+}
+
+std::optional<SurrogateInfo>
+ClassResolver::ResolveSurrogate(const std::wstring_view &aAppID,
+                                Diagnostics &aDiagnostics) const {
+  auto readSurrogate = [this,
+                        &aAppID]() -> std::variant<std::wstring, LSTATUS> {
+    std::wstring subKeyAppid(L"AppID\\"sv);
+    subKeyAppid += aAppID;
+
+    std::wstring path;
+    LSTATUS result = mStore.GetString(subKeyAppid, L"DllSurrogate", path);
+    if (result != ERROR_SUCCESS) {
+      return result;
+    }
+
+    return path;
+  };
+
+  std::variant<std::wstring, LSTATUS> surrogatePath =
+      mSurrogates.GetOrCompute(FoldCase(aAppID), readSurrogate);
+
+  if (std::holds_alternative<LSTATUS>(surrogatePath)) {
+    aDiagnostics.push_back(
+        {DiagnosticStep::ReadDllSurrogate, std::get<LSTATUS>(surrogatePath)});
+    return std::nullopt;
+  }
+
+  aDiagnostics.push_back({DiagnosticStep::ReadDllSurrogate, ERROR_SUCCESS});
+  return SurrogateInfo{std::wstring(aAppID),
+                       std::move(std::get<std::wstring>(surrogatePath))};
+}
+
+ProxyInfo ClassResolver::ResolveProxy(REFIID aIid,
+                                      Diagnostics &aDiagnostics) const {
+  std::pair<ProxyInfo, Diagnostics> proxy =
+      mProxies.GetOrCompute(aIid, [this, &aIid]() {
+        Diagnostics diagnostics;
+        ProxyInfo info = QueryProxy(mStore, aIid, diagnostics);
+        return std::make_pair(std::move(info), std::move(diagnostics));
+      });
+
+  // Replay the diagnostics, since each report is expected to stand alone.
+  aDiagnostics.insert(aDiagnostics.end(), proxy.second.begin(),
+                      proxy.second.end());
+  return std::move(proxy.first);
+}
+
+} // namespace aptinfo
@@ -0,0 +1,226 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "aptinfo.h"
+
+#include "utils.h"
+
+using namespace ::std::literals::string_view_literals;
+
+namespace aptinfo {
+
+void ScanFilters::SetServerPathPattern(const std::wstring_view &aPattern) {
+  std::wstring pattern(FoldCase(aPattern));
+  if (pattern.find_first_of(L"*?"sv) == std::wstring::npos) {
+    // No wildcards, so treat this as a prefix.
+    pattern += L'*';
+  }
+
+  mServerPathPattern.emplace(std::move(pattern));
+}
+
+void ScanFilters::SetClsidRange(REFCLSID aFirst, REFCLSID aLast) {
+  // Normalize both ends so that we may compare them against key names.
+  wchar_t strFirst[kGuidLenWithBracesInclNul] = {};
+  wchar_t strLast[kGuidLenWithBracesInclNul] = {};
+  ::StringFromGUID2(aFirst, strFirst, static_cast<int>(ArrayLength(strFirst)));
+  ::StringFromGUID2(aLast, strLast, static_cast<int>(ArrayLength(strLast)));
+  mClsidRange.emplace(strFirst, strLast);
+}
+
+// Both arguments must already be case-folded.
+static bool MatchesGlob(const std::wstring_view &aPattern,
+                        const std::wstring_view &aText) {
+  size_t pos = 0;
+  size_t textPos = 0;
+  size_t starPos = std::wstring_view::npos;
+  size_t starTextPos = 0;
+
+  while (textPos < aText.size()) {
+    if (pos < aPattern.size() &&
+        (aPattern[pos] == L'?' || aPattern[pos] == aText[textPos])) {
+      ++pos;
+      ++textPos;
+    } else if (pos < aPattern.size() && aPattern[pos] == L'*') {
+      starPos = pos++;
+      starTextPos = textPos;
+    } else if (starPos != std::wstring_view::npos) {
+      // Backtrack: let the most recent star consume one more character.
+      pos = starPos + 1;
+      textPos = ++starTextPos;
+    } else {
+      return false;
+    }
+  }
+
+  while (pos < aPattern.size() && aPattern[pos] == L'*') {
+    ++pos;
+  }
+
+  return pos == aPattern.size();
+}
+
+static bool IsInClsidRange(const ScanFilters &aFilters,
+                           const std::wstring_view &aKeyName) {
+  if (!aFilters.mClsidRange) {
+    return true;
+  }
+
+  // Since GUIDs in registry format are fixed-width hex, comparing them as
+  // strings is equivalent to comparing them numerically.
+  const auto &[first, last] = aFilters.mClsidRange.value();
+  const wchar_t *keyName = aKeyName.data();
+  return _wcsnicmp(keyName, first.c_str(), kGuidLenWithBracesExclNul) >= 0 &&
+         _wcsnicmp(keyName, last.c_str(), kGuidLenWithBracesExclNul) <= 0;
+}
+
+// Nearly every class lacks both TreatAs and AutoTreatAs, so one pass over
+// the class's own subkeys saves reading each of them for every class in
+// range.
+static bool IsEmulated(const ClassStore &aStore,
+                       const std::wstring &aSubKeyClsid) {
+  bool emulated = false;
+  aStore.EnumSubKeys(aSubKeyClsid, [&emulated](const std::wstring_view &aKey) {
+    const std::wstring name(aKey);
+    emulated = emulated || !_wcsicmp(name.c_str(), L"TreatAs") ||
+               !_wcsicmp(name.c_str(), L"AutoTreatAs");
+  });
+
+  return emulated;
+}
+
+static bool MatchesValueFilters(const ClassStore &aStore,
+                                const ScanFilters &aFilters,
+                                const std::wstring &aSubKeyClsid) {
+  for (const ValueFilter &filter : aFilters.mValueFilters) {
+    std::wstring subKey(aSubKeyClsid);
+    if (!filter.mSubKey.empty()) {
+      subKey += L'\\';
+      subKey += filter.mSubKey;
+    }
+
+    const bool present =
+        aStore.HasValue(subKey, filter.mValueName.c_str()) == ERROR_SUCCESS;
+    if (present != filter.mPresent) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool MatchesServerPath(const ClassStore &aStore,
+                              const ScanFilters &aFilters,
+                              const std::wstring &aSubKeyClsid) {
+  if (!aFilters.mServerPathPattern) {
+    return true;
+  }
+
+  for (const std::wstring_view serverKey :
+       {L"\\InprocServer32"sv, L"\\LocalServer32"sv}) {
+    std::wstring subKey(aSubKeyClsid);
+    subKey += serverKey;
+
+    std::wstring serverPath;
+    if (aStore.GetString(subKey, nullptr, serverPath) != ERROR_SUCCESS) {
+      continue;
+    }
+
+    std::wstring_view path(serverPath);
+    if (!path.empty() && path[0] == L'"') {
+      // LocalServer32 paths are frequently quoted.
+      path.remove_prefix(1);
+    }
+
+    if (MatchesGlob(aFilters.mServerPathPattern.value(), FoldCase(path))) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+LSTATUS Scan(const ClassStore &aStore, const ScanFilters &aFilters,
+             const std::optional<IID> &aOptIid,
+             const std::function<void(ClassReport &&)> &aOnMatch,
+             ScanCounters &aCounters) {
+  // Matches are named the same way as everywhere else, including ProgIDs
+  // that are only reachable via CurVer.
+  std::variant<const ProgIDIndex *, LSTATUS> maybeIndex =
+      aStore.GetProgIDIndex();
+  if (std::holds_alternative<LSTATUS>(maybeIndex)) {
+    return std::get<LSTATUS>(maybeIndex);
+  }
+
+  const ProgIDIndex &index = *std::get<const ProgIDIndex *>(maybeIndex);
+
+  // Shared by every match, so that emulated classes, AppIDs and proxies that
+  // many classes refer to are each only resolved once.
+  ClassResolver resolver(aStore);
+
+  return aStore.EnumSubKeys(
+      L"CLSID", [&](const std::wstring_view &aStrClsid) {
+        ++aCounters.mVisited;
+
+        CLSID clsid;
+        if (aStrClsid.size() != kGuidLenWithBracesExclNul ||
+            FAILED(::CLSIDFromString(std::wstring(aStrClsid).c_str(),
+                                     &clsid))) {
+          ++aCounters.mSkippedNonClsid;
+          return;
+        }
+
+        // Filters are ordered from cheapest to most expensive: the range
+        // check needs no registry access at all.
+        if (!IsInClsidRange(aFilters, aStrClsid)) {
+          ++aCounters.mPrunedByRange;
+          return;
+        }
+
+        std::wstring subKeyClsid(L"CLSID\\"sv);
+        subKeyClsid += aStrClsid;
+
+        // COM instantiates the emulating class in place of this one, so its
+        // registration is what the remaining filters examine, just as it is
+        // what the report describes. Should the emulation be broken, we fall
+        // back to this class, as QueryClass does.
+        if (IsEmulated(aStore, subKeyClsid)) {
+          ++aCounters.mFollowedTreatAs;
+          std::variant<CLSID, LSTATUS> treatAs =
+              resolver.ResolveTreatAs(clsid);
+          if (std::holds_alternative<CLSID>(treatAs) &&
+              std::get<CLSID>(treatAs) != clsid) {
+            wchar_t strTreatAs[kGuidLenWithBracesInclNul] = {};
+            ::StringFromGUID2(std::get<CLSID>(treatAs), strTreatAs,
+                              static_cast<int>(ArrayLength(strTreatAs)));
+            subKeyClsid.assign(L"CLSID\\"sv);
+            subKeyClsid += BufToView(strTreatAs);
+          }
+        }
+
+        if (!MatchesValueFilters(aStore, aFilters, subKeyClsid)) {
+          ++aCounters.mPrunedByValue;
+          return;
+        }
+
+        if (!MatchesServerPath(aStore, aFilters, subKeyClsid)) {
+          ++aCounters.mPrunedByPath;
+          return;
+        }
+
+        ++aCounters.mMatched;
+
+        ClassReport report(
+            QueryClass(resolver, clsid, aOptIid, QueryMode::RegistryOnly));
+        if (std::optional<std::wstring_view> progId = index.GetProgID(clsid)) {
+          report.mProgID = progId.value();
+        }
+
+        aOnMatch(std::move(report));
+      });
+}
+
+} // namespace aptinfo
@@ -0,0 +1,206 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "aptinfo.h"
+
+#include <comdef.h>
+
+#include "apartment.h"
+
+using namespace ::std::literals::string_view_literals;
+
+_COM_SMARTPTR_TYPEDEF(IAgileObject, IID_IAgileObject);
+
+namespace aptinfo {
+
+const CLSID CLSID_FreeThreadedMarshaler = {
+    0x0000033A,
+    0x0000,
+    0x0000,
+    {0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46}};
+const CLSID CLSID_UniversalMarshaler = {
+    0x00020424,
+    0x0000,
+    0x0000,
+    {0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46}};
+
+std::wstring ComClassThreadInfo::GetThreadingModelDescription(
+    const ThreadingModel aThdModel, const bool aDescriptive) {
+  std::wstring result;
+
+  switch (aThdModel) {
+  case ThreadingModel::STA:
+    result = L"Single-threaded"sv;
+    if (aDescriptive) {
+      result +=
+          L":\n\tProxying is required to access from any other apartment"sv;
+    }
+    break;
+  case ThreadingModel::MTA:
+    result = L"Multi-threaded"sv;
+    if (aDescriptive) {
+      result +=
+          L":\n\tProxying is required to access from any single-threaded "sv
+          L"apartment"sv;
+    }
+
+    break;
+  case ThreadingModel::Both:
+    result = L"Both"sv;
+    if (aDescriptive) {
+      result += L":\n\tEither single-threaded or multi-threaded, but "sv
+                L"mutually-exclusive"sv;
+    }
+
+    break;
+  case ThreadingModel::Neutral:
+    result = L"Thread-neutral"sv;
+    if (aDescriptive) {
+      result +=
+          L":\n\tThis object may be invoked by any thread residing in any "sv
+          L"apartment"sv;
+    }
+
+    break;
+  default:
+    return result;
+  };
+
+  result += L".\n"sv;
+  return result;
+}
+
+const std::wstring_view
+ComClassThreadInfo::GetProvenanceDescription(const Provenance aProvenance) {
+  switch (aProvenance) {
+  case Provenance::Registry:
+    return L"System registry.\n"sv;
+  case Provenance::FreeThreadedMarshaler:
+    return L"Free-threaded marshaler.\n"sv;
+  case Provenance::Manifest:
+    return L"Manifest.\n"sv;
+  case Provenance::AgileObject:
+    return L"IAgileObject.\n"sv;
+  default:
+    return L"<ERROR: UNDEFINED PROVENANCE>"sv;
+  }
+}
+
+std::wstring
+ComClassThreadInfo::GetDescription(const ClassType aClassType,
+                                   const bool aDescriptive) const {
+  std::wstring result(aClassType == ClassType::Server ? L"Server "sv
+                                                      : L"Proxy "sv);
+  if (mThreadingModel7 == mThreadingModel8) {
+    result += L"threading model: "sv;
+    result += GetThreadingModelDescription(mThreadingModel7, aDescriptive);
+    result += L"Provenance: "sv;
+    result += GetProvenanceDescription(mProvenance7);
+    return result;
+  }
+
+  result += L"has different threading models depending on the application's "sv
+            L"supported OS version.\n\n"sv;
+  result += L"For applications indicating compatibility with Windows 7 or "sv
+            L"older,\nthe threading model is "sv;
+  result += GetThreadingModelDescription(mThreadingModel7, aDescriptive);
+  result += L"Provenance: "sv;
+  result += GetProvenanceDescription(mProvenance7);
+  result +=
+      L"\n\nFor applications indicating compatibility with Windows 8 or "sv
+      L"newer,\nthe threading model is "sv;
+  result += GetThreadingModelDescription(mThreadingModel8, aDescriptive);
+  result += L"Provenance: "sv;
+  result += GetProvenanceDescription(mProvenance8);
+  return result;
+}
+
+ComClassThreadInfo ComClassThreadInfo::CheckObjectCapabilities(
+    REFCLSID aClsid, const std::optional<IID> &aOptIid,
+    Diagnostics &aDiagnostics) const {
+  if (mThreadingModel7 == ThreadingModel::Neutral) {
+    // We're already neutral, these additional checks are unnecessary.
+    return *this;
+  }
+
+  std::optional<ComClassThreadInfo> result;
+  RunInApartment(mThreadingModel7, [&](const Apartment &aApt) {
+    aDiagnostics.push_back(
+        {DiagnosticStep::EnterApartment, aApt.GetHResult()});
+    if (aApt) {
+      result.emplace(
+          CheckObjectCapabilitiesInApartment(aClsid, aOptIid, aDiagnostics));
+    }
+  });
+
+  if (!result) {
+    return *this;
+  }
+
+  return std::move(result.value());
+}
+
+ComClassThreadInfo ComClassThreadInfo::CheckObjectCapabilitiesInApartment(
+    REFCLSID aClsid, const std::optional<IID> &aOptIid,
+    Diagnostics &aDiagnostics) const {
+  ThreadingModel thdModel7 = mThreadingModel7;
+  Provenance prov7 = mProvenance7;
+  ThreadingModel thdModel8 = mThreadingModel7;
+  Provenance prov8 = mProvenance7;
+
+  IUnknownPtr punk;
+  HRESULT hr = punk.CreateInstance(aClsid, nullptr, CLSCTX_INPROC_SERVER);
+  aDiagnostics.push_back({DiagnosticStep::CreateInstance, hr});
+  if (FAILED(hr)) {
+    return *this;
+  }
+
+  IAgileObjectPtr agile;
+  hr = punk.QueryInterface(IID_IAgileObject, &agile);
+  aDiagnostics.push_back({DiagnosticStep::QueryAgileObject, hr});
+  if (SUCCEEDED(hr)) {
+    thdModel8 = ThreadingModel::Neutral;
+    prov8 = Provenance::AgileObject;
+  }
+
+  // We need an IID to do any further checks
+  if (!aOptIid.has_value()) {
+    return ComClassThreadInfo{thdModel7, prov7, thdModel8, prov8};
+  }
+
+  // Check for the free-threaded marshaler
+  IMarshalPtr marshal;
+  hr = punk.QueryInterface(IID_IMarshal, &marshal);
+  aDiagnostics.push_back({DiagnosticStep::QueryMarshal, hr});
+  if (FAILED(hr)) {
+    return ComClassThreadInfo{thdModel7, prov7, thdModel8, prov8};
+  }
+
+  CLSID unmarshalClass;
+  hr = marshal->GetUnmarshalClass(aOptIid.value(), nullptr, MSHCTX_INPROC,
+                                  nullptr, MSHLFLAGS_NORMAL, &unmarshalClass);
+  if (SUCCEEDED(hr) && unmarshalClass != CLSID_FreeThreadedMarshaler) {
+    // Distinguish "not the FTM" from "is the FTM" for the benefit of callers
+    // inspecting the diagnostics.
+    hr = S_FALSE;
+  }
+
+  aDiagnostics.push_back({DiagnosticStep::GetUnmarshalClass, hr});
+  if (hr != S_OK) {
+    return ComClassThreadInfo{thdModel7, prov7, thdModel8, prov8};
+  }
+
+  thdModel7 = ThreadingModel::Neutral;
+  prov7 = Provenance::FreeThreadedMarshaler;
+  if (thdModel8 != ThreadingModel::Neutral) {
+    thdModel8 = ThreadingModel::Neutral;
+    prov8 = Provenance::FreeThreadedMarshaler;
+  }
+
+  return ComClassThreadInfo{thdModel7, prov7, thdModel8, prov8};
+}
+
+} // namespace aptinfo
@@ -4,95 +4,50 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <string_view>
 #include <utility>
 #include <variant>
+#include <vector>
 
-#include <comdef.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <objbase.h>
 #include <windows.h>
 
-using namespace ::std::literals::string_view_literals;
-
-_COM_SMARTPTR_TYPEDEF(IAgileObject, IID_IAgileObject);
-
-template <typename T, size_t N>
-static inline constexpr size_t ArrayLength(T (&aArr)[N]) {
-  return N;
-}
-
-template <typename ExitFnT> class ScopeExit final {
-public:
-  explicit ScopeExit(ExitFnT &&aExitFn)
-      : mExitFn(std::forward<ExitFnT>(aExitFn)), mExecute(true) {}
-
-  ScopeExit(ScopeExit &&aRhs)
-      : mExitFn(std::move(aRhs)), mExecute(aRhs.mExecute) {
-    aRhs.release();
-  }
-
-  ~ScopeExit() {
-    if (!mExecute) {
-      return;
-    }
-
-    mExitFn();
-  }
+#include "aptinfo.h"
+#include "proxydll.h"
+#include "utils.h"
 
-  void release() { mExecute = false; }
-
-  ScopeExit(ScopeExit const &) = delete;
-  ScopeExit &operator=(ScopeExit const &) = delete;
-  ScopeExit &operator=(ScopeExit &&) = delete;
-
-private:
-  ExitFnT mExitFn;
-  bool mExecute;
-};
-
-template <typename ExitFnT>
-[[nodiscard]] ScopeExit<ExitFnT> MakeScopeExit(ExitFnT &&aExitFn) {
-  return ScopeExit<ExitFnT>(std::forward<ExitFnT>(aExitFn));
-}
-
-static std::wstring_view BufToView(const wchar_t *aBuf,
-                                   const size_t aNumBytesInclNul) {
-  if (aNumBytesInclNul < (2 * sizeof(wchar_t))) {
-    return std::wstring_view();
-  }
-
-  return std::wstring_view(aBuf,
-                           ((aNumBytesInclNul + 1) / sizeof(wchar_t)) - 1);
-}
+using namespace ::std::literals::string_view_literals;
 
-template <size_t N>
-static std::wstring_view BufToView(const wchar_t (&aBuf)[N]) {
-  return std::wstring_view(aBuf, N - 1);
-}
+using aptinfo::ClassReport;
+using aptinfo::ClassStore;
+using aptinfo::ClassType;
+using aptinfo::Diagnostic;
+using aptinfo::DiagnosticStep;
+using aptinfo::ServerKind;
 
-static constexpr int kGuidLenWithBracesInclNul = 39;
-static constexpr int kGuidLenWithBracesExclNul = kGuidLenWithBracesInclNul - 1;
-static constexpr size_t kThreadingModelBufCharLen = ArrayLength(L"Apartment");
-static const CLSID CLSID_FreeThreadedMarshaler = {
-    0x0000033A,
-    0x0000,
-    0x0000,
-    {0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46}};
-static const CLSID CLSID_UniversalMarshaler = {
-    0x00020424,
-    0x0000,
-    0x0000,
-    {0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46}};
+static constexpr size_t kMaxBatchLineLen = 1024;
+static constexpr unsigned int kMaxHivesInFlight = 16;
 
 static wchar_t gStrClsid[kGuidLenWithBracesInclNul];
 static wchar_t gStrIid[kGuidLenWithBracesInclNul];
 static const wchar_t *gProgID;
 static std::optional<CLSID> gClsid;
 static std::optional<IID> gIid;
+static const wchar_t *gBatchFile;
+static const wchar_t *gHiveFile;
+static bool gHiveCopy;
+static const wchar_t *gHiveListFile;
+static const wchar_t *gProxyDllDir;
+static std::optional<aptinfo::ProxyDllIndex> gProxyDlls;
+static bool gScan;
+static aptinfo::ScanFilters gScanFilters;
 static bool gDescriptive;
 static bool gVerbose;
 
@@ -109,12 +64,63 @@ static void Usage(const wchar_t *aArgv0, const wchar_t *aMsg = nullptr) {
     name = fname;
   }
 
-  fwprintf_s(stderr, L"Usage: %s [-d] [-v] <ProgID or CLSID> [IID]\n\n", name);
+  fwprintf_s(stderr,
+             L"Usage: %s [-d] [-v] [-o <hive> [-l]] [-x <dir>] "
+             L"<ProgID or CLSID> [IID]\n",
+             name);
+  fwprintf_s(stderr,
+             L"       %s [-d] [-v] [-o <hive> [-l]] -b <list file> [IID]\n",
+             name);
+  fwprintf_s(stderr,
+             L"       %s [-d] [-v] [-o <hive> [-l]] -s [-p <server path>] "
+             L"[-a <value>]\n\t\t[-n <value>] [-r <first CLSID> <last CLSID>] "
+             L"[IID]\n",
+             name);
+  fwprintf_s(stderr,
+             L"       %s [-d] [-v] -f <hive list file> -s [filters] [IID]\n\n",
+             name);
   fwprintf_s(stderr, L"Where:\n\n");
   fwprintf_s(stderr,
              L"\t-d\tDescriptive mode: include additional descriptive text in "
              L"output\n");
   fwprintf_s(stderr, L"\t-v\tVerbose mode (implies -d)\n");
+  fwprintf_s(stderr,
+             L"\t-o\tRead registrations from an offline SOFTWARE or "
+             L"UsrClass.dat hive\n\t\tinstead of the system registry. "
+             L"Objects are never instantiated.\n");
+  fwprintf_s(stderr,
+             L"\t-l\tWith -o, read the hive file directly and replay its "
+             L".LOG1/.LOG2\n\t\ttransaction logs in memory. Neither the "
+             L"hive nor its logs are\n\t\tmodified.\n");
+  fwprintf_s(stderr,
+             L"\t-f\tScan each hive copy listed in the file, one per line, "
+             L"as -o -l\n\t\twould. Several hives are read at once.\n");
+  fwprintf_s(stderr,
+             L"\t-x\tSearch the proxy/stub DLLs in the given directory for "
+             L"interfaces\n\t\twhose proxy/stub class is not registered\n");
+  fwprintf_s(stderr,
+             L"\t-b\tBatch mode: query each ProgID or CLSID listed in the "
+             L"file,\n\t\tone per line\n");
+  fwprintf_s(stderr,
+             L"\t-s\tScan mode: list every registered class that matches all "
+             L"of the\n\t\tfollowing filters, without instantiating any of "
+             L"them\n");
+  fwprintf_s(stderr,
+             L"\t-p\tOnly classes whose server path starts with the given "
+             L"prefix,\n\t\tor matches it when it contains * or ? "
+             L"wildcards\n");
+  fwprintf_s(stderr,
+             L"\t-a\tOnly classes having the given value, specified as "
+             L"[subkey\\]name\n\t\trelative to the class's CLSID key; "
+             L"may be repeated\n");
+  fwprintf_s(stderr, L"\t-n\tOnly classes lacking the given value; may be "
+                     L"repeated\n");
+  fwprintf_s(stderr,
+             L"\t-r\tOnly classes whose CLSIDs fall within the given "
+             L"inclusive range\n");
+  fwprintf_s(stderr,
+             L"\t\t-p, -a and -n examine the emulating class of any class "
+             L"that is\n\t\temulated via TreatAs\n");
   fwprintf_s(stderr,
              L"\n\tIID is optional, but omitting it may result in incomplete "
              L"output.\n");
@@ -136,12 +142,83 @@ static bool ParseArgv(const int argc, wchar_t *argv[]) {
       } else if (argv[i][1] == L'v') {
         gDescriptive = true;
         gVerbose = true;
+      } else if (argv[i][1] == L'o') {
+        if (++i == argc) {
+          Usage(argv[0], L"Offline mode requires a hive file.");
+          return false;
+        }
+
+        gHiveFile = argv[i];
+      } else if (argv[i][1] == L'l') {
+        gHiveCopy = true;
+      } else if (argv[i][1] == L'f') {
+        if (++i == argc) {
+          Usage(argv[0], L"Hive list mode requires a list file.");
+          return false;
+        }
+
+        gHiveListFile = argv[i];
+      } else if (argv[i][1] == L'x') {
+        if (++i == argc) {
+          Usage(argv[0], L"Proxy/stub search requires a directory.");
+          return false;
+        }
+
+        gProxyDllDir = argv[i];
+      } else if (argv[i][1] == L'b') {
+        if (++i == argc) {
+          Usage(argv[0], L"Batch mode requires a list file.");
+          return false;
+        }
+
+        gBatchFile = argv[i];
+      } else if (argv[i][1] == L's') {
+        gScan = true;
+      } else if (argv[i][1] == L'p') {
+        if (++i == argc) {
+          Usage(argv[0], L"Server path filter requires a pattern.");
+          return false;
+        }
+
+        gScanFilters.SetServerPathPattern(argv[i]);
+      } else if (argv[i][1] == L'a' || argv[i][1] == L'n') {
+        const bool present = argv[i][1] == L'a';
+        if (++i == argc) {
+          Usage(argv[0], L"Value filter requires a value name.");
+          return false;
+        }
+
+        const std::wstring_view spec(argv[i]);
+        const size_t separator = spec.rfind(L'\\');
+        if (separator == std::wstring_view::npos) {
+          gScanFilters.mValueFilters.push_back(
+              {std::wstring(), std::wstring(spec), present});
+        } else {
+          gScanFilters.mValueFilters.push_back(
+              {std::wstring(spec.substr(0, separator)),
+               std::wstring(spec.substr(separator + 1)), present});
+        }
+      } else if (argv[i][1] == L'r') {
+        if (argc - i < 3) {
+          Usage(argv[0], L"CLSID range requires first and last CLSIDs.");
+          return false;
+        }
+
+        GUID first, last;
+        if (FAILED(::CLSIDFromString(argv[i + 1], &first)) ||
+            FAILED(::CLSIDFromString(argv[i + 2], &last))) {
+          Usage(argv[0], L"Failed to parse CLSID range.");
+          return false;
+        }
+
+        gScanFilters.SetClsidRange(first, last);
+        i += 2;
       }
     } else if (argv[i][0] == L'{' &&
                wcslen(argv[i]) == kGuidLenWithBracesExclNul) {
       GUID guid;
 
-      if (!gClsid.has_value()) {
+      if (!gClsid.has_value() && !gProgID) {
         if (FAILED(::CLSIDFromString(argv[i], &guid))) {
           Usage(argv[0], L"Failed to parse CLSID.");
           return false;
@@ -158,522 +235,345 @@ static bool ParseArgv(const int argc, wchar_t *argv[]) {
         wcscpy_s(gStrIid, argv[i]);
         gIid.emplace(guid);
       }
-    } else if (!gClsid.has_value()) {
-      // ProgID?
-      CLSID clsid;
-
-      if (FAILED(::CLSIDFromProgID(argv[i], &clsid))) {
-        Usage(argv[0], L"Invalid ProgID.");
-        return false;
-      }
+    } else if (!gClsid.has_value() && !gProgID) {
+      // ProgID? This is resolved once we know which class store to use.
+      gProgID = argv[i];
+    }
+  }
 
-      gClsid.emplace(clsid);
+  if (gHiveCopy && !gHiveFile) {
+    Usage(argv[0], L"Log replay requires a hive file.");
+    return false;
+  }
 
-      if (!::StringFromGUID2(clsid, gStrClsid,
-                             static_cast<int>(ArrayLength(gStrClsid)))) {
-        Usage(argv[0], L"Failed converting CLSID to string.");
-        return false;
-      }
+  if (gHiveListFile && (gHiveFile || !gScan)) {
+    Usage(argv[0], L"A hive list may only be used in scan mode, and not "
+                   L"together with -o.");
+    return false;
+  }
 
-      gProgID = argv[i];
-    }
+  if (gBatchFile && gScan) {
+    Usage(argv[0], L"Batch mode and scan mode are mutually exclusive.");
+    return false;
   }
 
-  if (!gClsid) {
-    Usage(argv[0], L"You must provide either a CLSID or a ProgID.");
+  if (!gScan && !gScanFilters.IsEmpty()) {
+    Usage(argv[0], L"Filters are only supported in scan mode.");
     return false;
   }
 
-  if (gVerbose) {
-    wprintf_s(L"Using CLSID %s", gStrClsid);
-    if (gProgID) {
-      wprintf_s(L" obtained from ProgID \"%s\"", gProgID);
+  if (gBatchFile || gScan) {
+    if (gProgID || gIid) {
+      Usage(argv[0], L"Batch and scan modes only accept an IID on the "
+                     L"command line.");
+      return false;
     }
 
-    wprintf_s(L".\n");
+    if (gClsid) {
+      // The only GUID on the command line is actually the IID.
+      gIid = gClsid;
+      gClsid.reset();
+      wcscpy_s(gStrIid, gStrClsid);
+      gStrClsid[0] = 0;
+    }
 
-    if (gIid) {
+    if (gVerbose && gIid) {
       wprintf_s(L"Using IID %s.\n", gStrIid);
     }
-  }
 
-  return true;
-}
-
-enum class ClassType {
-  Server,
-  Proxy,
-};
-
-enum class ThreadingModel {
-  STA,
-  MTA,
-  Both,
-  Neutral,
-};
-
-enum class Provenance {
-  Registry,
-  FreeThreadedMarshaler,
-  Manifest, // <-- unsupported by us (no public API), but still possible
-  AgileObject,
-};
-
-class ComClassThreadInfo final {
-public:
-  constexpr ComClassThreadInfo(const ThreadingModel aThdModel,
-                               const Provenance aProvenance)
-      : mThreadingModel7(aThdModel), mProvenance7(aProvenance),
-        mThreadingModel8(aThdModel), mProvenance8(aProvenance) {}
-
-  constexpr ComClassThreadInfo(const ThreadingModel aThdModel7,
-                               const Provenance aProvenance7,
-                               const ThreadingModel aThdModel8,
-                               const Provenance aProvenance8)
-      : mThreadingModel7(aThdModel7), mProvenance7(aProvenance7),
-        mThreadingModel8(aThdModel8), mProvenance8(aProvenance8) {}
-
-  std::wstring GetDescription(const ClassType aClassType) const;
-
-  ComClassThreadInfo
-  CheckObjectCapabilities(REFCLSID aClsid,
-                          const std::optional<IID> &aOptIid) const;
-
-  ComClassThreadInfo(const ComClassThreadInfo &) = default;
-  ComClassThreadInfo(ComClassThreadInfo &&) = default;
-  ComClassThreadInfo &operator=(const ComClassThreadInfo &) = delete;
-  ComClassThreadInfo &operator=(ComClassThreadInfo &&) = delete;
-
-private:
-  static std::wstring
-  GetThreadingModelDescription(const ThreadingModel aThdModel);
-  static const std::wstring_view
-  GetProvenanceDescription(const Provenance aProvenance);
-
-private:
-  const ThreadingModel mThreadingModel7;
-  const Provenance mProvenance7;
-  const ThreadingModel mThreadingModel8;
-  const Provenance mProvenance8;
-};
-
-std::wstring ComClassThreadInfo::GetThreadingModelDescription(
-    const ThreadingModel aThdModel) {
-  std::wstring result;
-
-  switch (aThdModel) {
-  case ThreadingModel::STA:
-    result = L"Single-threaded"sv;
-    if (gDescriptive) {
-      result +=
-          L":\n\tProxying is required to access from any other apartment"sv;
-    }
-    break;
-  case ThreadingModel::MTA:
-    result = L"Multi-threaded"sv;
-    if (gDescriptive) {
-      result +=
-          L":\n\tProxying is required to access from any single-threaded "sv
-          L"apartment"sv;
-    }
-
-    break;
-  case ThreadingModel::Both:
-    result = L"Both"sv;
-    if (gDescriptive) {
-      result += L":\n\tEither single-threaded or multi-threaded, but "sv
-                L"mutually-exclusive"sv;
-    }
-
-    break;
-  case ThreadingModel::Neutral:
-    result = L"Thread-neutral"sv;
-    if (gDescriptive) {
-      result +=
-          L":\n\tThis object may be invoked by any thread residing in any "sv
-          L"apartment"sv;
-    }
-
-    break;
-  default:
-    return result;
-  };
-
-  result += L".\n"sv;
-  return result;
-}
+    return true;
+  }
 
-const std::wstring_view
-ComClassThreadInfo::GetProvenanceDescription(const Provenance aProvenance) {
-  switch (aProvenance) {
-  case Provenance::Registry:
-    return L"System registry.\n"sv;
-  case Provenance::FreeThreadedMarshaler:
-    return L"Free-threaded marshaler.\n"sv;
-  case Provenance::Manifest:
-    return L"Manifest.\n"sv;
-  case Provenance::AgileObject:
-    return L"IAgileObject.\n"sv;
-  default:
-    return L"<ERROR: UNDEFINED PROVENANCE>"sv;
+  if (!gClsid && !gProgID) {
+    Usage(argv[0], L"You must provide either a CLSID or a ProgID.");
+    return false;
   }
-}
 
-std::wstring
-ComClassThreadInfo::GetDescription(const ClassType aClassType) const {
-  std::wstring result(aClassType == ClassType::Server ? L"Server "sv
-                                                      : L"Proxy "sv);
-  if (mThreadingModel7 == mThreadingModel8) {
-    result += L"threading model: "sv;
-    result += GetThreadingModelDescription(mThreadingModel7);
-    result += L"Provenance: "sv;
-    result += GetProvenanceDescription(mProvenance7);
-    return result;
-  }
-
-  result += L"has different threading models depending on the application's "sv
-            L"supported OS version.\n\n"sv;
-  result += L"For applications indicating compatibility with Windows 7 or "sv
-            L"older,\nthe threading model is "sv;
-  result += GetThreadingModelDescription(mThreadingModel7);
-  result += L"Provenance: "sv;
-  result += GetProvenanceDescription(mProvenance7);
-  result +=
-      L"\n\nFor applications indicating compatibility with Windows 8 or "sv
-      L"newer,\nthe threading model is "sv;
-  result += GetThreadingModelDescription(mThreadingModel8);
-  result += L"Provenance: "sv;
-  result += GetProvenanceDescription(mProvenance8);
-  return result;
+  return true;
 }
 
-static bool HasDllSurrogate(const std::wstring_view &aStrClsid) {
-  if (gVerbose) {
-    wprintf_s(L"Checking for DLL surrogate... ");
-  }
+static bool ResolveProgID(const ClassStore &aStore) {
+  CLSID clsid;
 
-  std::wstring subKeyClsid(L"CLSID\\"sv);
-  subKeyClsid += aStrClsid;
-
-  wchar_t appIdBuf[kGuidLenWithBracesInclNul] = {};
-  DWORD numBytes = sizeof(appIdBuf);
-  LSTATUS result =
-      ::RegGetValueW(HKEY_CLASSES_ROOT, subKeyClsid.c_str(), L"AppID",
-                     RRF_RT_REG_SZ, nullptr, appIdBuf, &numBytes);
-  if (result != ERROR_SUCCESS) {
-    if (gVerbose) {
-      wprintf_s(L"No AppID.\n");
+  if (aStore.IsSystem()) {
+    if (FAILED(::CLSIDFromProgID(gProgID, &clsid))) {
+      fwprintf_s(stderr, L"Invalid ProgID.\n");
+      return false;
+    }
+  } else {
+    std::variant<const aptinfo::ProgIDIndex *, LSTATUS> index =
+        aStore.GetProgIDIndex();
+    if (std::holds_alternative<LSTATUS>(index)) {
+      fwprintf_s(stderr, L"ProgID enumeration failed with code %ld.\n",
+                 std::get<LSTATUS>(index));
+      return false;
     }
 
-    return false;
-  }
-
-  const std::wstring_view appId(BufToView(appIdBuf, numBytes));
-
-  std::wstring subKeyAppid(L"AppID\\"sv);
-  subKeyAppid += appId;
-
-  wchar_t surrogate[MAX_PATH + 1] = {};
-  numBytes = sizeof(surrogate);
-  result =
-      ::RegGetValueW(HKEY_CLASSES_ROOT, subKeyAppid.c_str(), L"DllSurrogate",
-                     RRF_RT_REG_SZ, nullptr, surrogate, &numBytes);
-  if (result != ERROR_SUCCESS) {
-    if (gVerbose) {
-      wprintf_s(L"AppID does not have DllSurrogate value.\n");
+    std::optional<CLSID> maybeClsid =
+        std::get<const aptinfo::ProgIDIndex *>(index)->Lookup(gProgID);
+    if (!maybeClsid) {
+      fwprintf_s(stderr, L"Invalid ProgID.\n");
+      return false;
     }
 
-    return false;
+    clsid = maybeClsid.value();
   }
 
-  if (gVerbose) {
-    std::wstring strSurrogate;
-    if (surrogate[0]) {
-      strSurrogate = L"\""sv;
-      strSurrogate += surrogate;
-      strSurrogate += L"\""sv;
-    } else {
-      strSurrogate = L"System default (dllhost.exe)"sv;
-    }
+  gClsid.emplace(clsid);
 
-    wprintf_s(L"%s.\n", strSurrogate.c_str());
+  if (!::StringFromGUID2(clsid, gStrClsid,
+                         static_cast<int>(ArrayLength(gStrClsid)))) {
+    fwprintf_s(stderr, L"Failed converting CLSID to string.\n");
+    return false;
   }
 
   return true;
 }
 
-static std::variant<ComClassThreadInfo, LSTATUS>
-GetClassThreadingModel(const std::wstring_view &aStrClsid) {
-  std::wstring subKeyInprocServer(L"CLSID\\"sv);
-  subKeyInprocServer += aStrClsid;
-  subKeyInprocServer += L"\\InprocServer32"sv;
-
-  wchar_t threadingModelBuf[kThreadingModelBufCharLen] = {};
-  DWORD numBytes = sizeof(threadingModelBuf);
-  LSTATUS result = ::RegGetValueW(HKEY_CLASSES_ROOT, subKeyInprocServer.c_str(),
-                                  L"ThreadingModel", RRF_RT_REG_SZ, nullptr,
-                                  threadingModelBuf, &numBytes);
-  if (result == ERROR_FILE_NOT_FOUND) {
-    // Check if the subkey exists, at least. If not, the class is not
-    // registered at all. If it is registered, then we're just missing the
-    // ThreadingModel registry value.
-    HKEY regKeyInprocServer;
-    LSTATUS subkeyOpened =
-        ::RegOpenKeyEx(HKEY_CLASSES_ROOT, subKeyInprocServer.c_str(), 0,
-                       KEY_READ, &regKeyInprocServer);
-    if (subkeyOpened != ERROR_SUCCESS) {
-      return result;
-    }
-
-    // The class *is* registered, just missing its ThreadingModel. Close the key
-    // and fall-through for additional processing.
-    ::RegCloseKey(regKeyInprocServer);
-  } else if (result != ERROR_SUCCESS) {
-    return result;
+static void PrintServerPath(const std::optional<LONG> &aResult,
+                            const std::wstring &aServerPath) {
+  if (!aResult) {
+    return;
   }
 
-  wchar_t serverDllPath[MAX_PATH + 1] = {};
-  numBytes = sizeof(serverDllPath);
-  LSTATUS pathResult =
-      ::RegGetValueW(HKEY_CLASSES_ROOT, subKeyInprocServer.c_str(), nullptr,
-                     RRF_RT_REG_SZ, nullptr, serverDllPath, &numBytes);
-  if (pathResult == ERROR_SUCCESS) {
+  if (aResult.value() == ERROR_SUCCESS) {
     if (gVerbose) {
-      wprintf_s(L"Path to server DLL: \"%s\"\n", serverDllPath);
+      wprintf_s(L"Path to server DLL: \"%s\"\n", aServerPath.c_str());
     }
   } else {
     wprintf_s(L"WARNING: Failed to retrieve path to server DLL, code %ld!\n",
-              pathResult);
+              aResult.value());
   }
-
-  // Empty or non-existent ThreadingModel implies STA.
-  if (result == ERROR_FILE_NOT_FOUND || threadingModelBuf[0] == 0 ||
-      !_wcsicmp(threadingModelBuf, L"Apartment")) {
-    return ComClassThreadInfo{ThreadingModel::STA, Provenance::Registry};
-  }
-
-  if (!_wcsicmp(threadingModelBuf, L"Free")) {
-    return ComClassThreadInfo{ThreadingModel::MTA, Provenance::Registry};
-  }
-
-  if (!_wcsicmp(threadingModelBuf, L"Both")) {
-    return ComClassThreadInfo{ThreadingModel::Both, Provenance::Registry};
-  }
-
-  if (!_wcsicmp(threadingModelBuf, L"Neutral")) {
-    return ComClassThreadInfo{ThreadingModel::Neutral, Provenance::Registry};
-  }
-
-  return static_cast<LSTATUS>(ERROR_UNIDENTIFIED_ERROR);
 }
 
-class Apartment final {
-public:
-  explicit Apartment(const ThreadingModel aThdModel)
-      : mHr(::CoInitializeEx(nullptr, (aThdModel == ThreadingModel::STA)
-                                          ? COINIT_APARTMENTTHREADED
-                                          : COINIT_MULTITHREADED)) {}
+static void PrintObjectCapabilities(const ClassReport &aReport) {
+  for (const Diagnostic &diag : aReport.mDiagnostics) {
+    const HRESULT hr = diag.mCode;
 
-  ~Apartment() {
-    if (FAILED(mHr)) {
-      return;
-    }
+    switch (diag.mStep) {
+    case DiagnosticStep::EnterApartment:
+      if (gVerbose) {
+        wprintf_s(L"Entering apartment... ");
+        if (FAILED(hr)) {
+          wprintf_s(L"Failed with HRESULT 0x%08lX.\n", hr);
+        } else {
+          wprintf_s(L"OK.\n");
+        }
+      }
 
-    ::CoUninitialize();
-  }
+      if (FAILED(hr)) {
+        wprintf_s(L"WARNING: Could not enter a test apartment. Results might "
+                  L"be incomplete!\n");
+      }
 
-  explicit operator bool() const { return SUCCEEDED(mHr); }
-  HRESULT GetHResult() const { return mHr; }
+      break;
+    case DiagnosticStep::CreateInstance:
+      if (gVerbose) {
+        wprintf_s(L"Creating object... ");
+        if (FAILED(hr)) {
+          wprintf_s(L"Failed with HRESULT 0x%08lX.\n", hr);
+        } else {
+          wprintf_s(L"OK.\n");
+        }
+      }
 
-  Apartment(const Apartment &) = delete;
-  Apartment(Apartment &&) = delete;
-  Apartment &operator=(const Apartment &) = delete;
-  Apartment &operator=(Apartment &&) = delete;
+      if (FAILED(hr)) {
+        wprintf_s(L"WARNING: Could not create a test instance. Results might "
+                  L"be incomplete!\n");
+      }
 
-private:
-  const HRESULT mHr;
-};
+      break;
+    case DiagnosticStep::QueryAgileObject:
+      if (gVerbose) {
+        wprintf_s(L"Querying for IAgileObject... ");
+        if (SUCCEEDED(hr)) {
+          wprintf_s(L"Found.\n");
+        } else if (hr == E_NOINTERFACE) {
+          wprintf_s(L"Not found.\n");
+        } else {
+          wprintf_s(L"Failed with HRESULT 0x%08lX.\n", hr);
+        }
+      }
 
-ComClassThreadInfo ComClassThreadInfo::CheckObjectCapabilities(
-    REFCLSID aClsid, const std::optional<IID> &aOptIid) const {
-  if (mThreadingModel7 == ThreadingModel::Neutral) {
-    // We're already neutral, these additional checks are unnecessary.
-    return *this;
-  }
+      if (!gIid.has_value()) {
+        wprintf_s(L"WARNING: IID required to query for free-threaded "
+                  L"marshaler.\n\tResults might be incomplete!\n");
+      }
 
-  ThreadingModel thdModel7 = mThreadingModel7;
-  Provenance prov7 = mProvenance7;
-  ThreadingModel thdModel8 = mThreadingModel7;
-  Provenance prov8 = mProvenance7;
+      break;
+    case DiagnosticStep::QueryMarshal:
+      if (gVerbose) {
+        wprintf_s(L"Querying for IMarshal... ");
+        if (SUCCEEDED(hr)) {
+          wprintf_s(L"Found.\nChecking whether object aggregates the "
+                    L"free-threaded marshaler... ");
+        } else if (hr == E_NOINTERFACE) {
+          wprintf_s(L"Not found.\n");
+        } else {
+          wprintf_s(L"Failed with HRESULT 0x%08lX.\n", hr);
+        }
+      }
 
-  if (gVerbose) {
-    wprintf_s(L"Entering apartment... ");
-  }
+      break;
+    case DiagnosticStep::GetUnmarshalClass:
+      if (gVerbose) {
+        if (FAILED(hr)) {
+          wprintf_s(L"Failed with HRESULT 0x%08lX.\n", hr);
+        } else if (hr == S_OK) {
+          wprintf_s(L"Yes.\n");
+        } else {
+          wprintf_s(L"No.\n");
+        }
+      }
 
-  Apartment apt(mThreadingModel7);
-  if (!apt) {
-    if (gVerbose) {
-      wprintf_s(L"Failed with HRESULT 0x%08lX.\n", apt.GetHResult());
+      break;
+    default:
+      break;
     }
-
-    wprintf_s(L"WARNING: Could not enter a test apartment. Results might be "
-              L"incomplete!\n");
-    return *this;
   }
+}
 
-  if (gVerbose) {
-    wprintf_s(L"OK.\nCreating object... ");
+static void PrintSurrogate(const ClassReport &aReport) {
+  if (!gVerbose) {
+    return;
   }
 
-  IUnknownPtr punk;
-  HRESULT hr = punk.CreateInstance(aClsid, nullptr, CLSCTX_INPROC_SERVER);
-  if (FAILED(hr)) {
-    if (gVerbose) {
-      wprintf_s(L"Failed with HRESULT 0x%08lX.\n", hr);
-    }
+  wprintf_s(L"Checking for DLL surrogate... ");
 
-    wprintf_s(L"WARNING: Could not create a test instance. Results might be "
-              L"incomplete!\n");
-    return *this;
-  } else if (gVerbose) {
-    wprintf_s(L"OK.\n");
+  if (aReport.GetResult(DiagnosticStep::ReadAppID) != ERROR_SUCCESS) {
+    wprintf_s(L"No AppID.\n");
+    return;
   }
 
-  if (gVerbose) {
-    wprintf_s(L"Querying for IAgileObject... ");
+  if (!aReport.mSurrogate) {
+    wprintf_s(L"AppID does not have DllSurrogate value.\n");
+    return;
   }
 
-  IAgileObjectPtr agile;
-  hr = punk.QueryInterface(IID_IAgileObject, &agile);
-  if (SUCCEEDED(hr)) {
-    if (gVerbose) {
-      wprintf_s(L"Found.\n");
-    }
-
-    thdModel8 = ThreadingModel::Neutral;
-    prov8 = Provenance::AgileObject;
-  } else if (gVerbose) {
-    if (hr == E_NOINTERFACE) {
-      wprintf_s(L"Not found.\n");
-    } else {
-      wprintf_s(L"Failed with HRESULT 0x%08lX.\n", hr);
-    }
+  std::wstring strSurrogate;
+  if (!aReport.mSurrogate->mSurrogatePath.empty()) {
+    strSurrogate = L"\""sv;
+    strSurrogate += aReport.mSurrogate->mSurrogatePath;
+    strSurrogate += L"\""sv;
+  } else {
+    strSurrogate = L"System default (dllhost.exe)"sv;
   }
 
-  // We need an IID to do any further checks
-  if (!aOptIid.has_value()) {
-    wprintf_s(L"WARNING: IID required to query for free-threaded "
-              L"marshaler.\n\tResults might be incomplete!\n");
-    return ComClassThreadInfo{thdModel7, prov7, thdModel8, prov8};
-  }
+  wprintf_s(L"%s.\n", strSurrogate.c_str());
+}
 
-  if (gVerbose) {
-    wprintf_s(L"Querying for IMarshal... ");
+// Lists the proxy/stub DLLs found via -x that can marshal gIid even though
+// the registry does not say so.
+static void PrintUnregisteredProxies() {
+  if (!gProxyDlls) {
+    return;
   }
 
-  // Check for the free-threaded marshaler
-  IMarshalPtr marshal;
-  hr = punk.QueryInterface(IID_IMarshal, &marshal);
-  if (FAILED(hr)) {
-    if (gVerbose) {
-      if (hr == E_NOINTERFACE) {
-        wprintf_s(L"Not found.\n");
-      } else {
-        wprintf_s(L"Failed with HRESULT 0x%08lX.\n", hr);
-      }
-    }
-
-    return ComClassThreadInfo{thdModel7, prov7, thdModel8, prov8};
-  } else if (gVerbose) {
-    wprintf_s(L"Found.\nChecking whether object aggregates the free-threaded "
-              L"marshaler... ");
-  }
+  aptinfo::RawGuid iid;
+  static_assert(sizeof(iid) == sizeof(IID));
+  memcpy(&iid, &gIid.value(), sizeof(iid));
 
-  CLSID unmarshalClass;
-  hr = marshal->GetUnmarshalClass(aOptIid.value(), nullptr, MSHCTX_INPROC,
-                                  nullptr, MSHLFLAGS_NORMAL, &unmarshalClass);
-  if (FAILED(hr)) {
-    if (gVerbose) {
-      wprintf_s(L"Failed with HRESULT 0x%08lX.\n", hr);
+  bool found = false;
+  gProxyDlls->Lookup(iid, [&found](const aptinfo::ProxyDllInfo &aDll,
+                                   const aptinfo::ProxiedInterface &aEntry) {
+    if (!found) {
+      wprintf_s(L"Unregistered proxy/stub DLLs that can marshal this "
+                L"interface:\n");
+      found = true;
     }
 
-    return ComClassThreadInfo{thdModel7, prov7, thdModel8, prov8};
-  }
-
-  if (unmarshalClass == CLSID_FreeThreadedMarshaler) {
-    if (gVerbose) {
-      wprintf_s(L"Yes.\n");
-    }
+    wprintf_s(L"\t\"%s\" (%S)\n", aDll.mPath.c_str(), aEntry.mName.c_str());
+  });
 
-    thdModel7 = ThreadingModel::Neutral;
-    prov7 = Provenance::FreeThreadedMarshaler;
-    if (thdModel8 != ThreadingModel::Neutral) {
-      thdModel8 = ThreadingModel::Neutral;
-      prov8 = Provenance::FreeThreadedMarshaler;
-    }
-  } else if (gVerbose) {
-    wprintf_s(L"No.\n");
+  if (!found && gVerbose) {
+    wprintf_s(L"None of the proxy/stub DLLs in \"%s\" can marshal this "
+              L"interface.\n",
+              gProxyDllDir);
   }
-
-  return ComClassThreadInfo{thdModel7, prov7, thdModel8, prov8};
 }
 
-static int CheckProxyForInterface(const std::wstring_view &aStrIid) {
+static int PrintProxy(const ClassReport &aReport) {
   if (gVerbose) {
     wprintf_s(L"Checking interface's proxy/stub class...\n");
   }
 
-  std::wstring subKeyProxyStubClsid(L"Interface\\"sv);
-  subKeyProxyStubClsid += aStrIid;
-  subKeyProxyStubClsid += L"\\ProxyStubClsid32"sv;
+  const aptinfo::ProxyInfo &proxy = aReport.mProxy.value();
 
-  wchar_t proxyStubClsidBuf[kGuidLenWithBracesInclNul] = {};
-  DWORD numBytes = sizeof(proxyStubClsidBuf);
-  LSTATUS result =
-      ::RegGetValueW(HKEY_CLASSES_ROOT, subKeyProxyStubClsid.c_str(), nullptr,
-                     RRF_RT_REG_SZ, nullptr, proxyStubClsidBuf, &numBytes);
-  if (result != ERROR_SUCCESS) {
+  if (aReport.GetResult(DiagnosticStep::ReadProxyStubClsid) != ERROR_SUCCESS) {
     fwprintf_s(stderr, L"Could not resolve IID's proxy/stub CLSID.\n");
+    PrintUnregisteredProxies();
     return 1;
   }
 
-  CLSID proxyStubClsid;
-  if (FAILED(::CLSIDFromString(proxyStubClsidBuf, &proxyStubClsid))) {
+  if (!proxy.mProxyStubClsid) {
     fwprintf_s(stderr, L"Could not parse proxy/stub CLSID.\n");
     return 1;
   }
 
   if (gVerbose) {
-    if (proxyStubClsid == CLSID_UniversalMarshaler) {
+    if (proxy.IsUniversalMarshaler()) {
       wprintf_s(
           L"This interface uses OLE Automation for proxy/stub marshaling.\n");
     } else {
       wchar_t strProxyStubClsid[kGuidLenWithBracesInclNul] = {};
-      if (::StringFromGUID2(proxyStubClsid, strProxyStubClsid,
+      if (::StringFromGUID2(proxy.mProxyStubClsid.value(), strProxyStubClsid,
                             kGuidLenWithBracesInclNul)) {
         wprintf_s(L"CLSID for proxy/stub: %s\n", strProxyStubClsid);
       }
     }
   }
 
-  std::variant<ComClassThreadInfo, LSTATUS> proxyModel =
-      GetClassThreadingModel(BufToView(proxyStubClsidBuf, numBytes));
-  if (std::holds_alternative<LSTATUS>(proxyModel)) {
+  PrintServerPath(aReport.GetResult(DiagnosticStep::ReadProxyServerPath),
+                  proxy.mServerPath);
+
+  if (!proxy.mThreadInfo) {
     fwprintf_s(stderr, L"Could not resolve proxy/stub threading model.\n");
     return 1;
   }
 
   std::wstring output =
-      std::get<ComClassThreadInfo>(proxyModel).GetDescription(ClassType::Proxy);
+      proxy.mThreadInfo->GetDescription(ClassType::Proxy, gDescriptive);
   wprintf_s(L"%s", output.c_str());
   return 0;
 }
 
-int wmain(int argc, wchar_t *argv[]) {
-  if (!ParseArgv(argc, argv)) {
-    return 1;
+static void PrintTreatAs(const ClassReport &aReport) {
+  LSTATUS result = aReport.GetResult(DiagnosticStep::ResolveTreatAs).value();
+  if (result != ERROR_SUCCESS) {
+    wprintf_s(L"WARNING: Could not resolve TreatAs emulation (code %ld). "
+              L"Results describe\n\tthe class itself.\n",
+              result);
+    return;
+  }
+
+  if (!aReport.mTreatAs) {
+    return;
+  }
+
+  wchar_t strTreatAs[kGuidLenWithBracesInclNul] = {};
+  ::StringFromGUID2(aReport.mTreatAs.value(), strTreatAs,
+                    static_cast<int>(ArrayLength(strTreatAs)));
+  wprintf_s(L"Emulated by %s (via TreatAs).\n", strTreatAs);
+}
+
+// Failures to read ThreadingModel other than the class not being registered
+// at all.
+static std::optional<LSTATUS> GetInprocFailure(const ClassReport &aReport) {
+  LSTATUS result =
+      aReport.GetResult(DiagnosticStep::ReadThreadingModel).value();
+  if (result == ERROR_FILE_NOT_FOUND) {
+    return std::nullopt;
   }
 
+  // We read a ThreadingModel but could not make sense of it.
+  if (result == ERROR_SUCCESS) {
+    return static_cast<LSTATUS>(ERROR_UNIDENTIFIED_ERROR);
+  }
+
+  return result;
+}
+
+static int PrintReport(const ClassReport &aReport) {
   auto printDoneOnExit = MakeScopeExit([]() {
     if (gVerbose) {
       // This just helps to make verbose output easier to read.
@@ -683,17 +583,20 @@ int wmain(int argc, wchar_t *argv[]) {
     wprintf_s(L"\n");
   });
 
-  const std::wstring_view strClsid(BufToView(gStrClsid));
+  PrintTreatAs(aReport);
+  PrintServerPath(aReport.GetResult(DiagnosticStep::ReadServerPath),
+                  aReport.mServerPath);
+
+  if (aReport.mServerKind == ServerKind::InprocServer) {
+    PrintObjectCapabilities(aReport);
 
-  std::variant<ComClassThreadInfo, LSTATUS> inprocModel =
-      GetClassThreadingModel(strClsid);
-  if (std::holds_alternative<ComClassThreadInfo>(inprocModel)) {
-    std::wstring output = std::get<ComClassThreadInfo>(inprocModel)
-                              .CheckObjectCapabilities(gClsid.value(), gIid)
-                              .GetDescription(ClassType::Server);
+    std::wstring output = aReport.mThreadInfo->GetDescription(
+        ClassType::Server, gDescriptive);
     wprintf_s(L"When instantiating in-process (via CLSCTX_INPROC_SERVER):\n%s",
               output.c_str());
-    if (!HasDllSurrogate(strClsid)) {
+
+    PrintSurrogate(aReport);
+    if (!aReport.mSurrogate) {
       return 0;
     }
 
@@ -705,9 +608,9 @@ int wmain(int argc, wchar_t *argv[]) {
                 L"threading model of\n\tits proxy/stub class.\n");
     }
 
-    if (gIid.has_value()) {
+    if (aReport.mProxy) {
       // Ignore return value since we already have some success
-      CheckProxyForInterface(BufToView(gStrIid));
+      PrintProxy(aReport);
       return 0;
     }
 
@@ -716,39 +619,39 @@ int wmain(int argc, wchar_t *argv[]) {
     return 0;
   }
 
-  LSTATUS result = std::get<LSTATUS>(inprocModel);
-  if (result == ERROR_FILE_NOT_FOUND) {
-    if (gVerbose) {
-      wprintf_s(L"Class is not a registered in-process server.\n");
-    }
-  } else {
-    fwprintf_s(stderr, L"InprocServer32 query failed with code %ld.\n", result);
+  std::optional<LSTATUS> inprocFailure = GetInprocFailure(aReport);
+  if (inprocFailure) {
+    fwprintf_s(stderr, L"InprocServer32 query failed with code %ld.\n",
+               inprocFailure.value());
     return 1;
   }
 
   if (gVerbose) {
+    wprintf_s(L"Class is not a registered in-process server.\n");
     wprintf_s(L"Attempting to resolve as a local server...\n");
   }
 
-  std::wstring subKeyLocalServer(L"CLSID\\"sv);
-  subKeyLocalServer += strClsid;
-  subKeyLocalServer += L"\\LocalServer32"sv;
-
-  HKEY regKeyLocalServer;
-  result = ::RegOpenKeyExW(HKEY_CLASSES_ROOT, subKeyLocalServer.c_str(), 0,
-                           KEY_READ, &regKeyLocalServer);
+  LSTATUS result = aReport.GetResult(DiagnosticStep::OpenLocalServer).value();
   if (result == ERROR_FILE_NOT_FOUND) {
-    // Try querying for a class object that might have been registered at
-    // runtime. We need to enter an apartment before calling CoGetClassObject.
     if (gVerbose) {
       wprintf_s(L"CLSID is not a permanently-registered local server.\n");
+    }
+
+    // Runtime registrations can only be queried from the live registry.
+    std::optional<LONG> aptResult =
+        aReport.GetResult(DiagnosticStep::EnterClassObjectApartment);
+    if (!aptResult) {
+      fwprintf_s(stderr, L"CLSID is not a registered local server.\n");
+      return 1;
+    }
+
+    if (gVerbose) {
       wprintf_s(L"Entering apartment...\n");
     }
 
-    Apartment apt(ThreadingModel::MTA);
-    if (!apt) {
+    if (FAILED(aptResult.value())) {
       if (gVerbose) {
-        wprintf_s(L"Failed with HRESULT 0x%08lX.\n", apt.GetHResult());
+        wprintf_s(L"Failed with HRESULT 0x%08lX.\n", aptResult.value());
       }
 
       fwprintf_s(stderr, L"WARNING: Could not enter a test apartment. Results "
@@ -760,11 +663,8 @@ int wmain(int argc, wchar_t *argv[]) {
       wprintf_s(L"Attempting to resolve via CoGetClassObject... ");
     }
 
-    IClassFactoryPtr classFactory;
-    HRESULT hr = ::CoGetClassObject(
-        gClsid.value(), CLSCTX_LOCAL_SERVER, nullptr, IID_IClassFactory,
-        reinterpret_cast<void **>(
-            static_cast<IClassFactory **>(&classFactory)));
+    const HRESULT hr =
+        aReport.GetResult(DiagnosticStep::GetClassObject).value();
     if (FAILED(hr)) {
       if (gVerbose) {
         wprintf_s(L"\nFailed with HRESULT 0x%08lX.\n", hr);
@@ -780,8 +680,6 @@ int wmain(int argc, wchar_t *argv[]) {
   } else if (result != ERROR_SUCCESS) {
     fwprintf_s(stderr, L"LocalServer32 query failed with code %ld.\n", result);
     return 1;
-  } else {
-    ::RegCloseKey(regKeyLocalServer);
   }
 
   wprintf_s(L"When instantiating out-of-process (via CLSCTX_LOCAL_SERVER):\n");
@@ -792,11 +690,327 @@ int wmain(int argc, wchar_t *argv[]) {
         L"its proxy/stub class.\n");
   }
 
-  if (!gIid.has_value()) {
+  if (!aReport.mProxy) {
     fwprintf_s(stderr,
                L"ERROR: An IID must be provided to proceed any further.\n");
     return 1;
   }
 
-  return CheckProxyForInterface(BufToView(gStrIid));
+  return PrintProxy(aReport);
+}
+
+static void PrintScanMatch(const ClassReport &aReport) {
+  wchar_t strClsid[kGuidLenWithBracesInclNul] = {};
+  ::StringFromGUID2(aReport.mClsid, strClsid,
+                    static_cast<int>(ArrayLength(strClsid)));
+  if (aReport.mProgID.empty()) {
+    wprintf_s(L"%s:\n", strClsid);
+  } else {
+    wprintf_s(L"%s (%s):\n", strClsid, aReport.mProgID.c_str());
+  }
+
+  PrintTreatAs(aReport);
+  PrintServerPath(aReport.GetResult(DiagnosticStep::ReadServerPath),
+                  aReport.mServerPath);
+
+  if (aReport.mServerKind == ServerKind::InprocServer) {
+    std::wstring output = aReport.mThreadInfo->GetDescription(
+        ClassType::Server, gDescriptive);
+    wprintf_s(L"%s", output.c_str());
+    if (aReport.mSurrogate) {
+      wprintf_s(L"May also be instantiated out-of-process via a DLL "
+                L"surrogate.\n");
+    }
+  } else if (aReport.mServerKind == ServerKind::LocalServer) {
+    wprintf_s(L"Local server.\n");
+  } else if (std::optional<LSTATUS> failure = GetInprocFailure(aReport)) {
+    wprintf_s(L"InprocServer32 query failed with code %ld.\n",
+              failure.value());
+  } else {
+    wprintf_s(L"No permanently-registered server.\n");
+  }
+
+  if (aReport.mProxy) {
+    PrintProxy(aReport);
+  }
+
+  wprintf_s(L"\n");
+}
+
+static int RunBatch(const ClassStore &aStore) {
+  FILE *listFile;
+  if (_wfopen_s(&listFile, gBatchFile, L"rt, ccs=UTF-8")) {
+    fwprintf_s(stderr, L"Could not open list file \"%s\".\n", gBatchFile);
+    return 1;
+  }
+
+  auto closeOnExit = MakeScopeExit([listFile]() { fclose(listFile); });
+
+  if (gVerbose) {
+    wprintf_s(L"Indexing ProgIDs... ");
+  }
+
+  std::variant<const aptinfo::ProgIDIndex *, LSTATUS> maybeIndex =
+      aStore.GetProgIDIndex();
+  if (std::holds_alternative<LSTATUS>(maybeIndex)) {
+    fwprintf_s(stderr, L"ProgID enumeration failed with code %ld.\n",
+               std::get<LSTATUS>(maybeIndex));
+    return 1;
+  }
+
+  if (gVerbose) {
+    wprintf_s(L"OK.\n");
+  }
+
+  const aptinfo::ProgIDIndex &index =
+      *std::get<const aptinfo::ProgIDIndex *>(maybeIndex);
+
+  // Batches frequently name related classes, which then share lookups.
+  const aptinfo::ClassResolver resolver(aStore);
+
+  int exitCode = 0;
+  wchar_t line[kMaxBatchLineLen];
+  while (fgetws(line, static_cast<int>(ArrayLength(line)), listFile)) {
+    std::wstring_view entry(line);
+    const size_t first = entry.find_first_not_of(L" \t\r\n"sv);
+    if (first == std::wstring_view::npos || entry[first] == L'#') {
+      // Blank lines and comments
+      continue;
+    }
+
+    const size_t last = entry.find_last_not_of(L" \t\r\n"sv);
+    entry = entry.substr(first, last - first + 1);
+
+    CLSID clsid;
+    if (entry[0] == L'{') {
+      const std::wstring strEntry(entry);
+      if (entry.size() != kGuidLenWithBracesExclNul ||
+          FAILED(::CLSIDFromString(strEntry.c_str(), &clsid))) {
+        fwprintf_s(stderr, L"Failed to parse CLSID \"%s\".\n\n",
+                   strEntry.c_str());
+        exitCode = 1;
+        continue;
+      }
+    } else {
+      std::optional<CLSID> maybeClsid = index.Lookup(entry);
+      if (!maybeClsid) {
+        fwprintf_s(stderr, L"Invalid ProgID \"%s\".\n\n",
+                   std::wstring(entry).c_str());
+        exitCode = 1;
+        continue;
+      }
+
+      clsid = maybeClsid.value();
+    }
+
+    wchar_t strClsid[kGuidLenWithBracesInclNul];
+    if (!::StringFromGUID2(clsid, strClsid,
+                           static_cast<int>(ArrayLength(strClsid)))) {
+      fwprintf_s(stderr, L"Failed converting CLSID to string.\n\n");
+      exitCode = 1;
+      continue;
+    }
+
+    std::optional<std::wstring_view> progId = index.GetProgID(clsid);
+    if (progId) {
+      wprintf_s(L"%s (%.*s):\n", strClsid, static_cast<int>(progId->size()),
+                progId->data());
+    } else {
+      wprintf_s(L"%s:\n", strClsid);
+    }
+
+    if (PrintReport(aptinfo::QueryClass(resolver, clsid, gIid))) {
+      exitCode = 1;
+    }
+  }
+
+  return exitCode;
+}
+
+static void PrintScanCounters(const aptinfo::ScanCounters &aCounters) {
+  wprintf_s(L"Visited %lu classes: %lu not CLSIDs, %lu pruned by CLSID "
+            L"range,\n\t%lu emulated via TreatAs, %lu pruned by value "
+            L"filters,\n\t%lu pruned by server path, %lu matched.\n",
+            aCounters.mVisited, aCounters.mSkippedNonClsid,
+            aCounters.mPrunedByRange, aCounters.mFollowedTreatAs,
+            aCounters.mPrunedByValue, aCounters.mPrunedByPath,
+            aCounters.mMatched);
+}
+
+static int RunScan(const ClassStore &aStore) {
+  aptinfo::ScanCounters counters;
+  LSTATUS result = aptinfo::Scan(
+      aStore, gScanFilters, gIid,
+      [](ClassReport &&aReport) { PrintScanMatch(aReport); }, counters);
+  if (result != ERROR_SUCCESS) {
+    fwprintf_s(stderr, L"CLSID enumeration failed with code %ld.\n", result);
+    return 1;
+  }
+
+  PrintScanCounters(counters);
+  return 0;
+}
+
+static bool ReadHiveList(std::vector<std::wstring> &aHivePaths) {
+  FILE *listFile;
+  if (_wfopen_s(&listFile, gHiveListFile, L"rt, ccs=UTF-8")) {
+    fwprintf_s(stderr, L"Could not open hive list file \"%s\".\n",
+               gHiveListFile);
+    return false;
+  }
+
+  auto closeOnExit = MakeScopeExit([listFile]() { fclose(listFile); });
+
+  wchar_t line[kMaxBatchLineLen];
+  while (fgetws(line, static_cast<int>(ArrayLength(line)), listFile)) {
+    std::wstring_view entry(line);
+    const size_t first = entry.find_first_not_of(L" \t\r\n"sv);
+    if (first == std::wstring_view::npos || entry[first] == L'#') {
+      // Blank lines and comments
+      continue;
+    }
+
+    const size_t last = entry.find_last_not_of(L" \t\r\n"sv);
+    aHivePaths.emplace_back(entry.substr(first, last - first + 1));
+  }
+
+  return true;
+}
+
+static int RunHiveListScan() {
+  std::vector<std::wstring> hivePaths;
+  if (!ReadHiveList(hivePaths)) {
+    return 1;
+  }
+
+  // Hives are classified concurrently, but each one's output is printed in
+  // one piece.
+  std::mutex outputMutex;
+  int exitCode = 0;
+
+  ClassStore::OpenHiveCopies(
+      hivePaths, kMaxHivesInFlight,
+      [&hivePaths, &outputMutex, &exitCode](
+          const size_t aIndex,
+          std::variant<std::unique_ptr<ClassStore>, LSTATUS> &&aStore) {
+        const wchar_t *hivePath = hivePaths[aIndex].c_str();
+        if (std::holds_alternative<LSTATUS>(aStore)) {
+          std::lock_guard<std::mutex> lock(outputMutex);
+          fwprintf_s(stderr, L"Loading hive \"%s\" failed with code %ld.\n\n",
+                     hivePath, std::get<LSTATUS>(aStore));
+          exitCode = 1;
+          return;
+        }
+
+        const ClassStore &store =
+            *std::get<std::unique_ptr<ClassStore>>(aStore);
+
+        std::vector<ClassReport> matches;
+        aptinfo::ScanCounters counters;
+        LSTATUS result = aptinfo::Scan(
+            store, gScanFilters, gIid,
+            [&matches](ClassReport &&aReport) {
+              matches.push_back(std::move(aReport));
+            },
+            counters);
+
+        std::lock_guard<std::mutex> lock(outputMutex);
+        wprintf_s(L"Hive \"%s\":\n", hivePath);
+        if (gVerbose) {
+          wprintf_s(L"Replayed %u transaction log entries.\n",
+                    store.GetNumReplayedLogEntries());
+        }
+
+        wprintf_s(L"\n");
+
+        if (result != ERROR_SUCCESS) {
+          fwprintf_s(stderr, L"CLSID enumeration failed with code %ld.\n\n",
+                     result);
+          exitCode = 1;
+          return;
+        }
+
+        for (const ClassReport &report : matches) {
+          PrintScanMatch(report);
+        }
+
+        PrintScanCounters(counters);
+        wprintf_s(L"\n");
+      });
+
+  return exitCode;
+}
+
+int wmain(int argc, wchar_t *argv[]) {
+  if (!ParseArgv(argc, argv)) {
+    return 1;
+  }
+
+  if (gProxyDllDir) {
+    std::variant<std::vector<aptinfo::ProxyDllInfo>, aptinfo::ProxyDllStatus>
+        dlls = aptinfo::AnalyzeProxyDllDirectory(gProxyDllDir);
+    if (std::holds_alternative<aptinfo::ProxyDllStatus>(dlls)) {
+      fwprintf_s(stderr, L"Could not read proxy/stub directory \"%s\".\n",
+                 gProxyDllDir);
+      return 1;
+    }
+
+    gProxyDlls.emplace(
+        std::move(std::get<std::vector<aptinfo::ProxyDllInfo>>(dlls)));
+    if (gVerbose) {
+      wprintf_s(L"Found %zu interfaces in %zu proxy/stub DLLs.\n",
+                gProxyDlls->GetNumInterfaces(), gProxyDlls->GetNumDlls());
+    }
+  }
+
+  if (gHiveListFile) {
+    return RunHiveListScan();
+  }
+
+  std::unique_ptr<ClassStore> store;
+  if (gHiveFile) {
+    std::variant<std::unique_ptr<ClassStore>, LSTATUS> maybeStore =
+        gHiveCopy ? ClassStore::OpenHiveCopy(gHiveFile)
+                  : ClassStore::OpenHive(gHiveFile);
+    if (std::holds_alternative<LSTATUS>(maybeStore)) {
+      fwprintf_s(stderr, L"Loading hive \"%s\" failed with code %ld.\n",
+                 gHiveFile, std::get<LSTATUS>(maybeStore));
+      return 1;
+    }
+
+    store = std::move(std::get<std::unique_ptr<ClassStore>>(maybeStore));
+    if (gVerbose && gHiveCopy) {
+      wprintf_s(L"Replayed %u transaction log entries.\n",
+                store->GetNumReplayedLogEntries());
+    }
+  } else {
+    store = ClassStore::OpenSystem();
+  }
+
+  if (gBatchFile) {
+    return RunBatch(*store);
+  }
+
+  if (gScan) {
+    return RunScan(*store);
+  }
+
+  if (gProgID && !ResolveProgID(*store)) {
+    return 1;
+  }
+
+  if (gVerbose) {
+    wprintf_s(L"Using CLSID %s", gStrClsid);
+    if (gProgID) {
+      wprintf_s(L" obtained from ProgID \"%s\"", gProgID);
+    }
+
+    wprintf_s(L".\n");
+
+    if (gIid) {
+      wprintf_s(L"Using IID %s.\n", gStrIid);
+    }
+  }
+
+  return PrintReport(aptinfo::QueryClass(*store, gClsid.value(), gIid));
 }
@@ -0,0 +1,265 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Every test runs against both the reader that FileBatchReader::Create picks
+// and the thread pool, since only one of the two is the default on any given
+// machine. The files are generated into a scratch directory rather than
+// checked in, since several of them must span multiple of the io_uring
+// reader's 1 MiB chunks.
+
+#include "batchreader.h"
+
+#include <fstream>
+#include <functional>
+#include <map>
+#include <string>
+
+#include <string.h>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif // defined(__linux__)
+
+#include "testing.h"
+
+using aptinfo::FileBatchReader;
+using aptinfo::FileReadResult;
+
+using ReaderFactory =
+    std::function<std::unique_ptr<FileBatchReader>(unsigned int)>;
+using Results = std::map<uint64_t, std::optional<std::vector<uint8_t>>>;
+
+static constexpr size_t kMiB = 1024 * 1024;
+
+static std::filesystem::path gScratchDir;
+
+static std::vector<uint8_t> MakeContents(const size_t aSize,
+                                         const uint64_t aSeed) {
+  // Distinct per file and per offset, so that misplaced chunks are noticed.
+  std::vector<uint8_t> contents(aSize);
+  uint32_t state = static_cast<uint32_t>(aSeed * 2654435761U + 1);
+  for (uint8_t &byte : contents) {
+    state = state * 1664525U + 1013904223U;
+    byte = static_cast<uint8_t>(state >> 24);
+  }
+
+  return contents;
+}
+
+static std::filesystem::path WriteScratchFile(const char *aName,
+                                              const size_t aSize,
+                                              const uint64_t aSeed) {
+  const std::filesystem::path path = gScratchDir / aName;
+  const std::vector<uint8_t> contents = MakeContents(aSize, aSeed);
+  std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+  stream.write(reinterpret_cast<const char *>(contents.data()),
+               static_cast<std::streamsize>(contents.size()));
+  return path;
+}
+
+// Collects every outstanding result, counting any tag that is reported twice
+// as a failure.
+static void WaitForAll(FileBatchReader &aReader, Results &aResults) {
+  while (std::optional<FileReadResult> result = aReader.WaitForCompletion()) {
+    auto [itr, inserted] =
+        aResults.emplace(result->mTag, std::move(result->mData));
+    EXPECT(inserted);
+  }
+
+  // Once drained, the reader stays drained.
+  EXPECT(!aReader.WaitForCompletion());
+}
+
+static void ExpectContents(const Results &aResults, const uint64_t aTag,
+                           const size_t aSize) {
+  auto itr = aResults.find(aTag);
+  ASSERT(itr != aResults.end());
+  ASSERT(itr->second.has_value());
+  EXPECT(itr->second.value() == MakeContents(aSize, aTag));
+}
+
+static const size_t kSizes[] = {
+    0, 1, 4095, 4096, kMiB - 1, kMiB, kMiB + 1, 3 * kMiB - 7,
+};
+
+// Completions arrive in whatever order the storage finishes them, but every
+// tag must come back exactly once, with its own file's contents.
+static void TestOrdering(const ReaderFactory &aCreate) {
+  std::unique_ptr<FileBatchReader> reader = aCreate(4);
+  EXPECT(!reader->WaitForCompletion());
+
+  std::vector<std::filesystem::path> paths;
+  for (uint64_t tag = 0; tag < std::size(kSizes); ++tag) {
+    const std::string name = "order" + std::to_string(tag);
+    paths.push_back(WriteScratchFile(name.c_str(), kSizes[tag], tag));
+  }
+
+  // Submit the second half only once the first is underway.
+  const size_t half = paths.size() / 2;
+  Results results;
+  for (uint64_t tag = 0; tag < half; ++tag) {
+    reader->Submit(tag, paths[tag]);
+  }
+
+  std::optional<FileReadResult> first = reader->WaitForCompletion();
+  ASSERT(first.has_value());
+  results.emplace(first->mTag, std::move(first->mData));
+
+  for (uint64_t tag = half; tag < paths.size(); ++tag) {
+    reader->Submit(tag, paths[tag]);
+  }
+
+  WaitForAll(*reader, results);
+  EXPECT(results.size() == paths.size());
+  for (uint64_t tag = 0; tag < paths.size(); ++tag) {
+    ExpectContents(results, tag, kSizes[tag]);
+  }
+}
+
+// Files that cannot be opened or read fail on their own, without disturbing
+// the reads around them.
+static void TestOpenFailure(const ReaderFactory &aCreate) {
+  std::unique_ptr<FileBatchReader> reader = aCreate(2);
+
+  const std::filesystem::path good = WriteScratchFile("good", kMiB + 1, 1);
+  reader->Submit(0, gScratchDir / "missing");
+  reader->Submit(1, good);
+  reader->Submit(2, gScratchDir);
+
+  Results results;
+  WaitForAll(*reader, results);
+  EXPECT(results.size() == 3);
+  EXPECT(results.count(0) && !results[0].has_value());
+  ExpectContents(results, 1, kMiB + 1);
+  EXPECT(results.count(2) && !results[2].has_value());
+}
+
+// With fewer request slots than there are chunks, reads must queue up behind
+// one another rather than being dropped or overwriting each other's slots.
+static void TestQueueDepth(const ReaderFactory &aCreate) {
+  for (const unsigned int queueDepth : {1U, 2U, 3U}) {
+    std::unique_ptr<FileBatchReader> reader = aCreate(queueDepth);
+
+    std::vector<std::filesystem::path> paths;
+    for (uint64_t tag = 0; tag < 5; ++tag) {
+      const std::string name = "depth" + std::to_string(tag);
+      paths.push_back(WriteScratchFile(name.c_str(), 2 * kMiB + tag, tag));
+      reader->Submit(tag, paths.back());
+    }
+
+    Results results;
+    WaitForAll(*reader, results);
+    EXPECT(results.size() == paths.size());
+    for (uint64_t tag = 0; tag < paths.size(); ++tag) {
+      ExpectContents(results, tag, 2 * kMiB + tag);
+    }
+  }
+}
+
+// The io_uring reader sizes its buffer when the file is submitted, and only
+// starts reading once we wait. A file that shrinks in between comes up short,
+// which must fail the file rather than hand back a partly filled buffer. The
+// thread pool sizes and reads at the same time, so there is no such window.
+static void TestShortRead(const ReaderFactory &aCreate) {
+  std::unique_ptr<FileBatchReader> reader = aCreate(2);
+  if (strcmp(reader->GetName(), "io_uring")) {
+    return;
+  }
+
+  const std::filesystem::path path = WriteScratchFile("short", 2 * kMiB, 0);
+  reader->Submit(0, path);
+  std::filesystem::resize_file(path, kMiB + 7);
+
+  Results results;
+  WaitForAll(*reader, results);
+  ASSERT(results.count(0));
+  EXPECT(!results[0].has_value());
+}
+
+#if defined(__linux__)
+// Swaps /dev/null in for the reader's io_uring file descriptor, so that every
+// later io_uring_enter fails with an error that no retry can fix. The ring
+// itself stays alive, since the reader's mappings still refer to it.
+static bool BreakRing() {
+  int ringFd = -1;
+  std::error_code ec;
+  for (const std::filesystem::directory_entry &entry :
+       std::filesystem::directory_iterator("/proc/self/fd", ec)) {
+    if (std::filesystem::read_symlink(entry.path(), ec) ==
+        "anon_inode:[io_uring]") {
+      ringFd = std::stoi(entry.path().filename().string());
+    }
+  }
+
+  const int nullFd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+  if (ringFd < 0 || nullFd < 0) {
+    return false;
+  }
+
+  const bool swapped = ::dup2(nullFd, ringFd) == ringFd;
+  ::close(nullFd);
+  return swapped;
+}
+
+// Once the ring breaks, every file still outstanding must fail, including
+// those whose reads the kernel may still hold, and so must everything that
+// is submitted afterwards. Run this under AddressSanitizer to check that the
+// buffers of those reads are neither freed nor leaked.
+static void TestBrokenRing(const ReaderFactory &aCreate) {
+  std::unique_ptr<FileBatchReader> reader = aCreate(2);
+  if (strcmp(reader->GetName(), "io_uring")) {
+    return;
+  }
+
+  std::vector<std::filesystem::path> paths;
+  for (uint64_t tag = 0; tag < 3; ++tag) {
+    const std::string name = "broken" + std::to_string(tag);
+    paths.push_back(WriteScratchFile(name.c_str(), 3 * kMiB, tag));
+    reader->Submit(tag, paths.back());
+  }
+
+  // Get reads in flight before pulling the ring out from under them.
+  Results results;
+  std::optional<FileReadResult> first = reader->WaitForCompletion();
+  ASSERT(first.has_value());
+  results.emplace(first->mTag, std::move(first->mData));
+  ASSERT(BreakRing());
+
+  reader->Submit(3, paths[0]);
+  WaitForAll(*reader, results);
+  EXPECT(results.size() == 4);
+  for (const auto &[tag, data] : results) {
+    if (tag != first->mTag) {
+      EXPECT(!data.has_value());
+    }
+  }
+}
+#endif // defined(__linux__)
+
+static void RunTests(const ReaderFactory &aCreate) {
+  fprintf(stderr, "Testing the %s reader\n", aCreate(1)->GetName());
+  TestOrdering(aCreate);
+  TestOpenFailure(aCreate);
+  TestQueueDepth(aCreate);
+  TestShortRead(aCreate);
+#if defined(__linux__)
+  TestBrokenRing(aCreate);
+#endif // defined(__linux__)
+}
+
+int main() {
+  // CTest runs each test from within the build directory.
+  gScratchDir = std::filesystem::current_path() / "batchreader_scratch";
+  std::filesystem::remove_all(gScratchDir);
+  std::filesystem::create_directories(gScratchDir);
+
+  RunTests(&FileBatchReader::Create);
+  RunTests(&FileBatchReader::CreateThreadPool);
+
+  std::filesystem::remove_all(gScratchDir);
+  return aptinfo::testing::gNumFailures;
+}
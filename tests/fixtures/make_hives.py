@@ -0,0 +1,261 @@
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+"""Regenerates the hive fixtures in hives/.
+
+Every hive holds a single class, CLSID\\{00000000-0000-0000-0000-000000000001},
+whose InprocServer32 ThreadingModel tells which writes have been replayed.
+Each subdirectory exercises one way of combining a hive with its transaction
+logs; see hive_test.cpp for what each is expected to yield.
+"""
+
+import os
+import shutil
+import struct
+
+BASE_BLOCK_SIZE = 4096
+SECTOR_SIZE = 512
+BINS_SIZE = 8192
+PAGE_SIZE = 4096
+M = 0xFFFFFFFF
+MARVIN_SEED = 0x82EF4D887A4E55C5
+
+FILE_TYPE_PRIMARY = 0
+FILE_TYPE_LOG1 = 1
+FILE_TYPE_LOG_INCREMENTAL = 6
+
+
+def rotl(value, shift):
+    return ((value << shift) | (value >> (32 - shift))) & M
+
+
+def marvin32(data):
+    lo = MARVIN_SEED & M
+    hi = MARVIN_SEED >> 32
+
+    def mix(lo, hi):
+        hi ^= lo
+        lo = rotl(lo, 20)
+        lo = (lo + hi) & M
+        hi = rotl(hi, 9)
+        hi ^= lo
+        lo = rotl(lo, 27)
+        lo = (lo + hi) & M
+        hi = rotl(hi, 19)
+        return lo, hi
+
+    i = 0
+    while len(data) - i >= 4:
+        lo = (lo + struct.unpack_from('<I', data, i)[0]) & M
+        lo, hi = mix(lo, hi)
+        i += 4
+    final = 0x80
+    for byte in reversed(data[i:]):
+        final = ((final << 8) | byte) & M
+    lo = (lo + final) & M
+    lo, hi = mix(lo, hi)
+    lo, hi = mix(lo, hi)
+    return (hi << 32) | lo
+
+
+class Bins:
+    def __init__(self):
+        self.data = bytearray(BINS_SIZE)
+        self.data[0:4] = b'hbin'
+        struct.pack_into('<III', self.data, 4, 0, BINS_SIZE, 0)
+        self.pos = 32
+
+    def cell(self, payload):
+        size = (len(payload) + 4 + 7) & ~7
+        index = self.pos
+        struct.pack_into('<i', self.data, index, -size)
+        self.data[index + 4:index + 4 + len(payload)] = payload
+        self.pos += size
+        return index
+
+    def value(self, name, data):
+        encoded = name.encode('latin1')
+        offset = self.cell(data)
+        return self.cell(b'vk' + struct.pack('<HIIIHH', len(encoded),
+                                             len(data), offset, 1,
+                                             1 if encoded else 0, 0) +
+                         encoded)
+
+    def key(self, name, subkeys, values):
+        encoded = name.encode('latin1')
+        subkey_list = M
+        if subkeys:
+            subkey_list = self.cell(
+                b'lh' + struct.pack('<H', len(subkeys)) +
+                b''.join(struct.pack('<II', index, name_hash(sub_name))
+                         for sub_name, index in subkeys))
+        value_list = M
+        if values:
+            value_list = self.cell(b''.join(struct.pack('<I', v)
+                                            for v in values))
+        return self.cell(
+            b'nk' + struct.pack('<H', 0x20) + b'\0' * 8 +
+            struct.pack('<IIIIIIIIIIIIIIIHH', 0, 0, len(subkeys), 0,
+                        subkey_list, M, len(values), value_list, M, M, 0, 0,
+                        0, 0, 0, len(encoded), 0) + encoded)
+
+    def seal(self):
+        # The remainder of the bin is one free cell.
+        struct.pack_into('<i', self.data, self.pos, BINS_SIZE - self.pos)
+        return bytes(self.data)
+
+
+def name_hash(name):
+    result = 0
+    for char in name.upper():
+        result = (result * 37 + ord(char)) & M
+    return result
+
+
+def utf16(text):
+    return (text + '\0').encode('utf-16le')
+
+
+def make_bins(threading_model, move_root=False):
+    """Returns the bins data and the offset of its root key."""
+    bins = Bins()
+    if move_root:
+        # Pushes every cell further along, so that whatever used to be at the
+        # old root's offset is no longer a key node.
+        bins.cell(b'\0' * 0x200)
+    inproc = bins.key('InprocServer32', [], [
+        bins.value('ThreadingModel', utf16(threading_model)),
+        bins.value('', utf16('C:\\Windows\\System32\\fixture.dll')),
+    ])
+    clsid_name = '{00000000-0000-0000-0000-000000000001}'
+    cls = bins.key(clsid_name, [('InprocServer32', inproc)], [])
+    clsid = bins.key('CLSID', [(clsid_name, cls)], [])
+    root = bins.key('ROOT', [('CLSID', clsid)], [])
+    return bins.seal(), root
+
+
+def base_block(primary, secondary, file_type, root, size=BASE_BLOCK_SIZE):
+    block = bytearray(size)
+    block[0:4] = b'regf'
+    struct.pack_into('<IIQIIIIII', block, 4, primary, secondary, 0, 1, 6,
+                     file_type, 1, root, BINS_SIZE)
+    checksum = 0
+    for i in range(0, 508, 4):
+        checksum ^= struct.unpack_from('<I', block, i)[0]
+    if checksum == M:
+        checksum = 0xFFFFFFFE
+    elif checksum == 0:
+        checksum = 1
+    struct.pack_into('<I', block, 508, checksum)
+    return bytes(block)
+
+
+def dirty_pages(before, after):
+    return [offset for offset in range(0, BINS_SIZE, PAGE_SIZE)
+            if before[offset:offset + PAGE_SIZE] !=
+            after[offset:offset + PAGE_SIZE]]
+
+
+def log_entry(sequence, before, after):
+    pages = dirty_pages(before, after)
+    refs = b''.join(struct.pack('<II', offset, PAGE_SIZE) for offset in pages)
+    body = refs + b''.join(after[o:o + PAGE_SIZE] for o in pages)
+    size = (40 + len(body) + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1)
+    body = body.ljust(size - 40, b'\0')
+    header = bytearray(b'HvLE' + struct.pack('<IIIII', size, 0, sequence,
+                                             BINS_SIZE, len(pages)) +
+                       b'\0' * 16)
+    struct.pack_into('<Q', header, 24, marvin32(body))
+    struct.pack_into('<Q', header, 32, marvin32(bytes(header[:32])))
+    return bytes(header) + body
+
+
+def incremental_log(sequence, root, entries):
+    """entries is a list of (sequence, before, after) triples."""
+    return (base_block(sequence, sequence, FILE_TYPE_LOG_INCREMENTAL, root,
+                       SECTOR_SIZE) +
+            b''.join(log_entry(*entry) for entry in entries))
+
+
+def dirt_log(sequence, root, before, after):
+    # One bit per sector of the bins, followed by every dirty sector.
+    num_sectors = BINS_SIZE // SECTOR_SIZE
+    bitmap = bytearray((num_sectors + 7) // 8)
+    sectors = b''
+    for sector in range(num_sectors):
+        end = (sector + 1) * SECTOR_SIZE
+        if before[end - SECTOR_SIZE:end] != after[end - SECTOR_SIZE:end]:
+            bitmap[sector // 8] |= 1 << (sector % 8)
+            sectors += after[end - SECTOR_SIZE:end]
+    vector = (b'DIRT' + bytes(bitmap)).ljust(SECTOR_SIZE, b'\0')
+    return (base_block(sequence, sequence, FILE_TYPE_LOG1, root, SECTOR_SIZE) +
+            vector + sectors)
+
+
+def write(directory, hive, logs):
+    os.makedirs(directory)
+    with open(os.path.join(directory, 'hive'), 'wb') as f:
+        f.write(hive)
+    for extension, log in logs.items():
+        with open(os.path.join(directory, 'hive.' + extension), 'wb') as f:
+            f.write(log)
+
+
+def main():
+    out_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                           'hives')
+    shutil.rmtree(out_dir, ignore_errors=True)
+
+    # Value data of different lengths shifts the cells around, so each image
+    # has its own root offset.
+    apartment, root = make_bins('Apartment')
+    both, both_root = make_bins('Both')
+    free, free_root = make_bins('Free')
+    neutral, neutral_root = make_bins('Neutral')
+    moved, moved_root = make_bins('Free', move_root=True)
+
+    def hive(primary, secondary):
+        return base_block(primary, secondary, FILE_TYPE_PRIMARY, root) + \
+            apartment
+
+    # Nothing to replay
+    write(os.path.join(out_dir, 'clean'), hive(5, 5), {})
+
+    # Two consecutive entries in one log
+    write(os.path.join(out_dir, 'dirty'), hive(7, 5), {
+        'LOG1': incremental_log(7, free_root, [(5, apartment, both),
+                                               (6, both, free)]),
+    })
+
+    # The log begins after writes that neither file holds.
+    write(os.path.join(out_dir, 'gap'), hive(15, 9), {
+        'LOG1': incremental_log(15, free_root, [(14, apartment, free)]),
+    })
+
+    # Entry 5 is in both logs, and entry 6 only in the newer one.
+    write(os.path.join(out_dir, 'split'), hive(7, 5), {
+        'LOG1': incremental_log(6, both_root, [(5, apartment, both)]),
+        'LOG2': incremental_log(7, free_root, [(5, apartment, both),
+                                               (6, both, free)]),
+    })
+
+    # The logs disagree about entry 5, so the newer one must win.
+    write(os.path.join(out_dir, 'newer'), hive(6, 5), {
+        'LOG1': incremental_log(5, neutral_root, [(5, apartment, neutral)]),
+        'LOG2': incremental_log(6, both_root, [(5, apartment, both)]),
+    })
+
+    # The root key moves; only the log's base block says where to.
+    write(os.path.join(out_dir, 'moved'), hive(6, 5), {
+        'LOG1': incremental_log(6, moved_root, [(5, apartment, moved)]),
+    })
+
+    # An old-style log, which also moves the root
+    write(os.path.join(out_dir, 'dirt'), hive(6, 5), {
+        'LOG1': dirt_log(6, moved_root, apartment, moved),
+    })
+
+
+if __name__ == '__main__':
+    main()
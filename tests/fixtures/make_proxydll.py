@@ -0,0 +1,172 @@
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+"""Regenerates the proxy/stub DLL fixtures in proxydll/.
+
+Each DLL is a minimal PE image whose .rdata holds a MIDL-style
+ProxyFileInfo for IFooBar and IBaz2. Two decoys must never be reported:
+a ProxyFileInfo for ICodeDecoy that lives in .text, and one for IPadding
+that lives past .rdata's VirtualSize, in its file-alignment padding.
+
+wrap.dll is malformed on purpose, and must yield no ProxyFileInfo at all.
+"""
+
+import os
+import struct
+import uuid
+
+IID_FOO = uuid.UUID('0a1b2c3d-4e5f-4061-8293-a4b5c6d7e8f9')
+IID_BAZ = uuid.UUID('10203040-5060-4070-8090-a0b0c0d0e0f0')
+IID_DECOY = uuid.UUID('deadbeef-0000-4000-8000-000000000001')
+IID_PADDING = uuid.UUID('deadbeef-0000-4000-8000-000000000002')
+
+FILE_ALIGNMENT = 0x200
+HEADERS_SIZE = 0x400
+RDATA_RVA = 0x2000
+RDATA_VIRTUAL_SIZE = 0x400
+RDATA_RAW_SIZE = 0x600
+TEXT_RVA = 0x1000
+TEXT_SIZE = 0x200
+
+IMAGE_SCN_CNT_CODE = 0x00000020
+IMAGE_SCN_CNT_INITIALIZED_DATA = 0x00000040
+IMAGE_SCN_MEM_EXECUTE = 0x20000000
+IMAGE_SCN_MEM_READ = 0x40000000
+
+
+def pe_headers(ptr_size, image_base, sections):
+    """sections holds (name, virtual size, RVA, raw size, file offset,
+    characteristics) tuples."""
+    headers = bytearray(HEADERS_SIZE)
+    headers[0:2] = b'MZ'
+    struct.pack_into('<I', headers, 0x3C, 0x80)
+    headers[0x80:0x84] = b'PE\0\0'
+    optional_header_size = 0xF0 if ptr_size == 8 else 0xE0
+    machine = 0x8664 if ptr_size == 8 else 0x14C
+    struct.pack_into('<HHIIIHH', headers, 0x84, machine, len(sections), 0, 0,
+                     0, optional_header_size, 0x2022)
+    optional_header = 0x98
+    if ptr_size == 8:
+        struct.pack_into('<H', headers, optional_header, 0x20B)
+        struct.pack_into('<Q', headers, optional_header + 24, image_base)
+    else:
+        struct.pack_into('<H', headers, optional_header, 0x10B)
+        struct.pack_into('<I', headers, optional_header + 28, image_base)
+    struct.pack_into('<I', headers, optional_header + 36, FILE_ALIGNMENT)
+
+    section_table = optional_header + optional_header_size
+    for i, (name, virtual_size, rva, raw_size, offset, flags) in \
+            enumerate(sections):
+        header = section_table + i * 40
+        headers[header:header + 8] = name.ljust(8, b'\0')
+        struct.pack_into('<IIII', headers, header + 8, virtual_size, rva,
+                         raw_size, offset)
+        struct.pack_into('<I', headers, header + 36, flags)
+
+    return headers
+
+
+def make_image(ptr_size):
+    image_base = 0x180000000 if ptr_size == 8 else 0x10000000
+    ptr = '<Q' if ptr_size == 8 else '<I'
+    rdata = bytearray(RDATA_RAW_SIZE)
+    text = bytearray(TEXT_SIZE)
+
+    def rdata_va(offset):
+        return image_base + RDATA_RVA + offset
+
+    def put_table(buf, offset, entries):
+        # Null-terminated pointer list
+        for i, entry in enumerate(entries + [0]):
+            struct.pack_into(ptr, buf, offset + i * ptr_size, entry)
+
+    def put_interfaces(base, interfaces):
+        # Lays out IIDs, names, stub headers and the three lists starting at
+        # base, returning the addresses of the proxy, stub and name lists.
+        headers = []
+        names = []
+        for i, (iid, name) in enumerate(interfaces):
+            rdata[base + i * 16:base + i * 16 + 16] = iid.bytes_le
+            name_offset = base + 0x40 + i * 0x10
+            rdata[name_offset:name_offset + len(name) + 1] = \
+                name.encode('ascii') + b'\0'
+            header_offset = base + 0x60 + i * 0x20
+            struct.pack_into(ptr, rdata, header_offset, rdata_va(base + i * 16))
+            headers.append(rdata_va(header_offset))
+            names.append(rdata_va(name_offset))
+
+        put_table(rdata, base + 0xA0, headers)
+        put_table(rdata, base + 0xC0, names)
+        put_table(rdata, base + 0xE0, headers)
+        return rdata_va(base + 0xE0), rdata_va(base + 0xA0), \
+            rdata_va(base + 0xC0)
+
+    def put_proxy_file_info(buf, offset, lists, table_size):
+        for i, address in enumerate(lists):
+            struct.pack_into(ptr, buf, offset + i * ptr_size, address)
+        struct.pack_into('<HH', buf, offset + 5 * ptr_size, table_size, 2)
+
+    genuine = put_interfaces(0x000, [(IID_FOO, 'IFooBar'),
+                                     (IID_BAZ, 'IBaz2')])
+    put_proxy_file_info(rdata, 0x100, genuine, 2)
+
+    decoy = put_interfaces(0x200, [(IID_DECOY, 'ICodeDecoy')])
+    put_proxy_file_info(text, 0x40, decoy, 1)
+
+    padding = put_interfaces(RDATA_VIRTUAL_SIZE,
+                             [(IID_PADDING, 'IPadding')])
+    put_proxy_file_info(rdata, RDATA_VIRTUAL_SIZE + 0x100, padding, 1)
+
+    text_offset = HEADERS_SIZE
+    rdata_offset = text_offset + TEXT_SIZE
+    headers = pe_headers(ptr_size, image_base, [
+        (b'.text', TEXT_SIZE, TEXT_RVA, TEXT_SIZE, text_offset,
+         IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_READ),
+        (b'.rdata', RDATA_VIRTUAL_SIZE, RDATA_RVA, RDATA_RAW_SIZE,
+         rdata_offset, IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ),
+    ])
+    return bytes(headers + text + rdata)
+
+
+def make_wrapping_image():
+    """A PE32+ image based at zero whose single section maps the whole file
+    at RVA zero. Its one stub header points its IID just below 2**64, so
+    that naively adding the IID's length to that address wraps around to
+    the start of the file."""
+    size = 0x400
+    headers = pe_headers(8, 0, [
+        (b'.data', size, 0, size, 0,
+         IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ),
+    ])
+    image = headers + bytearray(size - len(headers))
+    # ProxyFileInfo: proxy, stub and name lists, then TableSize and
+    # TableVersion. Everything else stays zero.
+    struct.pack_into('<QQQ', image, 0x200, 0x300, 0x300, 0x320)
+    struct.pack_into('<HH', image, 0x200 + 5 * 8, 1, 2)
+    struct.pack_into('<QQ', image, 0x300, 0x340, 0)
+    struct.pack_into('<QQ', image, 0x320, 0x360, 0)
+    struct.pack_into('<Q', image, 0x340, 0xFFFFFFFFFFFFFFF8)
+    image[0x360:0x366] = b'IWrap\0'
+    return bytes(image)
+
+
+def main():
+    out_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                           'proxydll')
+    os.makedirs(out_dir, exist_ok=True)
+    with open(os.path.join(out_dir, 'ps32.dll'), 'wb') as f:
+        f.write(make_image(4))
+    # Upper case, since extensions are matched case-insensitively.
+    with open(os.path.join(out_dir, 'ps64.DLL'), 'wb') as f:
+        f.write(make_image(8))
+    with open(os.path.join(out_dir, 'wrap.dll'), 'wb') as f:
+        f.write(make_wrapping_image())
+    with open(os.path.join(out_dir, 'notpe.dll'), 'wb') as f:
+        f.write(b'MZ but nothing else')
+    with open(os.path.join(out_dir, 'ignored.txt'), 'wb') as f:
+        f.write(make_image(8))
+
+
+if __name__ == '__main__':
+    main()
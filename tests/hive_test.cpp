@@ -0,0 +1,112 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// The fixtures are produced by tests/fixtures/make_hives.py.
+
+#include "hive.h"
+
+#include <fstream>
+#include <iterator>
+
+#include "testing.h"
+
+using namespace ::std::literals::string_view_literals;
+
+using aptinfo::CellIndex;
+using aptinfo::Hive;
+using aptinfo::HiveStatus;
+using aptinfo::testing::GetFixturePath;
+
+static constexpr std::wstring_view kInprocServerPath =
+    L"CLSID\\{00000000-0000-0000-0000-000000000001}\\InprocServer32"sv;
+
+static std::filesystem::path GetHivePath(const char *aScenario) {
+  return GetFixturePath("hives") / aScenario / "hive";
+}
+
+static std::vector<uint8_t> ReadFile(const std::filesystem::path &aPath) {
+  std::ifstream stream(aPath, std::ios::binary);
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(stream),
+                              std::istreambuf_iterator<char>());
+}
+
+static void ExpectThreadingModel(const Hive &aHive,
+                                 const std::wstring_view &aExpected) {
+  CellIndex key;
+  ASSERT(aHive.FindKey(aHive.GetRootKey(), kInprocServerPath, key) ==
+         HiveStatus::Success);
+
+  std::wstring threadingModel;
+  ASSERT(aHive.GetString(key, L"ThreadingModel"sv, threadingModel) ==
+         HiveStatus::Success);
+  EXPECT(threadingModel == aExpected);
+}
+
+static void TestScenario(const char *aScenario, const bool aWasDirty,
+                         const uint32_t aNumApplied,
+                         const std::wstring_view &aExpected) {
+  const std::filesystem::path path = GetHivePath(aScenario);
+  const std::vector<uint8_t> original = ReadFile(path);
+
+  {
+    std::variant<Hive, HiveStatus> result = Hive::Open(path);
+    ASSERT(std::holds_alternative<Hive>(result));
+    const Hive &hive = std::get<Hive>(result);
+    EXPECT(hive.WasDirty() == aWasDirty);
+    EXPECT(hive.GetNumLogEntriesApplied() == aNumApplied);
+    ExpectThreadingModel(hive, aExpected);
+  }
+
+  // Replay happens in memory; the hive on disk must never change.
+  EXPECT(ReadFile(path) == original);
+
+  // Reading the files ourselves must make no difference.
+  std::vector<std::vector<uint8_t>> logs;
+  for (const std::filesystem::path &logPath : Hive::GetLogPaths(path)) {
+    if (std::filesystem::exists(logPath)) {
+      logs.push_back(ReadFile(logPath));
+    }
+  }
+
+  std::variant<Hive, HiveStatus> result =
+      Hive::FromBuffers(std::vector<uint8_t>(original), logs);
+  ASSERT(std::holds_alternative<Hive>(result));
+  EXPECT(std::get<Hive>(result).GetNumLogEntriesApplied() == aNumApplied);
+  ExpectThreadingModel(std::get<Hive>(result), aExpected);
+}
+
+static void TestFailures() {
+  std::variant<Hive, HiveStatus> missing =
+      Hive::Open(GetFixturePath("hives/missing"));
+  ASSERT(std::holds_alternative<HiveStatus>(missing));
+  EXPECT(std::get<HiveStatus>(missing) == HiveStatus::CannotOpen);
+
+  // A log is not a hive.
+  std::variant<Hive, HiveStatus> log = Hive::FromBuffers(
+      ReadFile(GetFixturePath("hives/dirty/hive.LOG1")), {});
+  ASSERT(std::holds_alternative<HiveStatus>(log));
+  EXPECT(std::get<HiveStatus>(log) == HiveStatus::NotAHive);
+
+  std::variant<Hive, HiveStatus> clean = Hive::Open(GetHivePath("clean"));
+  ASSERT(std::holds_alternative<Hive>(clean));
+  const Hive &hive = std::get<Hive>(clean);
+  CellIndex key;
+  EXPECT(hive.FindKey(hive.GetRootKey(), L"CLSID\\{missing}"sv, key) ==
+         HiveStatus::NotFound);
+}
+
+int main() {
+  TestScenario("clean", false, 0, L"Apartment"sv);
+  TestScenario("dirty", true, 2, L"Free"sv);
+  // Replaying entry 14 onto a hive at sequence 9 would skip entries 9-13.
+  TestScenario("gap", true, 0, L"Apartment"sv);
+  TestScenario("split", true, 2, L"Free"sv);
+  TestScenario("newer", true, 1, L"Both"sv);
+  TestScenario("moved", true, 1, L"Free"sv);
+  TestScenario("dirt", true, 1, L"Free"sv);
+  TestFailures();
+  return aptinfo::testing::gNumFailures;
+}
@@ -0,0 +1,79 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Ingests the fixtures produced by tests/fixtures/make_hives.py.
+
+#include "hiveingest.h"
+
+#include <mutex>
+
+#include "testing.h"
+
+using aptinfo::Hive;
+using aptinfo::HiveStatus;
+using aptinfo::IngestHives;
+using aptinfo::IngestOptions;
+using aptinfo::testing::GetFixturePath;
+
+namespace {
+
+struct Expected final {
+  const char *mScenario;
+  uint32_t mNumApplied;
+  bool mOpens;
+};
+
+} // anonymous namespace
+
+static const Expected kExpected[] = {
+    {"clean", 0, true},  {"dirty", 2, true}, {"missing", 0, false},
+    {"split", 2, true},  {"gap", 0, true},   {"dirt", 1, true},
+    {"newer", 1, true},  {"moved", 1, true},
+};
+
+static void TestIngest(const IngestOptions &aOptions) {
+  std::vector<std::filesystem::path> paths;
+  for (const Expected &expected : kExpected) {
+    paths.push_back(GetFixturePath("hives") / expected.mScenario / "hive");
+  }
+
+  // Indexed like paths; HiveStatus::Success for hives that opened.
+  std::mutex mutex;
+  std::vector<int> numCalls(paths.size());
+  std::vector<HiveStatus> statuses(paths.size(), HiveStatus::Success);
+  std::vector<uint32_t> numApplied(paths.size());
+
+  IngestHives(paths, aOptions,
+              [&](size_t aIndex, std::variant<Hive, HiveStatus> &&aResult) {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++numCalls.at(aIndex);
+                if (std::holds_alternative<HiveStatus>(aResult)) {
+                  statuses[aIndex] = std::get<HiveStatus>(aResult);
+                } else {
+                  numApplied[aIndex] =
+                      std::get<Hive>(aResult).GetNumLogEntriesApplied();
+                }
+              });
+
+  for (size_t i = 0; i < paths.size(); ++i) {
+    EXPECT(numCalls[i] == 1);
+    if (kExpected[i].mOpens) {
+      // Logs must reach the hive they belong to, however reads interleave.
+      EXPECT(statuses[i] == HiveStatus::Success);
+      EXPECT(numApplied[i] == kExpected[i].mNumApplied);
+    } else {
+      EXPECT(statuses[i] == HiveStatus::CannotOpen);
+    }
+  }
+}
+
+int main() {
+  // Everything at once, and then one hive and one read at a time.
+  TestIngest(IngestOptions());
+  TestIngest(IngestOptions{1, 1, 1});
+  TestIngest(IngestOptions{3, 2, 2});
+  return aptinfo::testing::gNumFailures;
+}
@@ -0,0 +1,123 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// The fixtures are produced by tests/fixtures/make_proxydll.py.
+
+#include "proxydll.h"
+
+#include <algorithm>
+
+#include "testing.h"
+
+using aptinfo::ProxiedInterface;
+using aptinfo::ProxyDllInfo;
+using aptinfo::ProxyDllStatus;
+using aptinfo::RawGuid;
+using aptinfo::testing::GetFixturePath;
+
+// {0A1B2C3D-4E5F-4061-8293-A4B5C6D7E8F9}
+static constexpr RawGuid kIidFooBar = {
+    0x0A1B2C3D,
+    0x4E5F,
+    0x4061,
+    {0x82, 0x93, 0xA4, 0xB5, 0xC6, 0xD7, 0xE8, 0xF9}};
+// {10203040-5060-4070-8090-A0B0C0D0E0F0}
+static constexpr RawGuid kIidBaz2 = {
+    0x10203040,
+    0x5060,
+    0x4070,
+    {0x80, 0x90, 0xA0, 0xB0, 0xC0, 0xD0, 0xE0, 0xF0}};
+// {DEADBEEF-0000-4000-8000-000000000001}, only present in decoy tables
+static constexpr RawGuid kIidCodeDecoy = {
+    0xDEADBEEF, 0x0000, 0x4000, {0x80, 0, 0, 0, 0, 0, 0, 0x01}};
+
+static void ExpectFixtureInterfaces(const ProxyDllInfo &aDll) {
+  // Neither the decoy table in .text nor the one in .rdata's padding may be
+  // reported.
+  ASSERT(aDll.mInterfaces.size() == 2);
+  EXPECT(aDll.mInterfaces[0].mIid == kIidFooBar);
+  EXPECT(aDll.mInterfaces[0].mName == "IFooBar");
+  EXPECT(aDll.mInterfaces[1].mIid == kIidBaz2);
+  EXPECT(aDll.mInterfaces[1].mName == "IBaz2");
+}
+
+static void TestSingleDll(const char *aName) {
+  std::variant<ProxyDllInfo, ProxyDllStatus> result =
+      aptinfo::AnalyzeProxyDll(GetFixturePath(aName));
+  ASSERT(std::holds_alternative<ProxyDllInfo>(result));
+  ExpectFixtureInterfaces(std::get<ProxyDllInfo>(result));
+}
+
+static void TestFailures() {
+  std::variant<ProxyDllInfo, ProxyDllStatus> result =
+      aptinfo::AnalyzeProxyDll(GetFixturePath("proxydll/notpe.dll"));
+  ASSERT(std::holds_alternative<ProxyDllStatus>(result));
+  EXPECT(std::get<ProxyDllStatus>(result) ==
+         ProxyDllStatus::NotPortableExecutable);
+
+  result = aptinfo::AnalyzeProxyDll(GetFixturePath("proxydll/missing.dll"));
+  ASSERT(std::holds_alternative<ProxyDllStatus>(result));
+  EXPECT(std::get<ProxyDllStatus>(result) == ProxyDllStatus::CannotOpen);
+
+  // The IID pointer in wrap.dll wraps around the address space when its
+  // length is added, which must not resolve to memory before the mapping.
+  result = aptinfo::AnalyzeProxyDll(GetFixturePath("proxydll/wrap.dll"));
+  ASSERT(std::holds_alternative<ProxyDllStatus>(result));
+  EXPECT(std::get<ProxyDllStatus>(result) == ProxyDllStatus::NoProxyFileInfo);
+
+  std::variant<std::vector<ProxyDllInfo>, ProxyDllStatus> dir =
+      aptinfo::AnalyzeProxyDllDirectory(GetFixturePath("missing"));
+  ASSERT(std::holds_alternative<ProxyDllStatus>(dir));
+  EXPECT(std::get<ProxyDllStatus>(dir) == ProxyDllStatus::CannotOpen);
+}
+
+static void TestDirectory(const unsigned int aNumThreads) {
+  std::variant<std::vector<ProxyDllInfo>, ProxyDllStatus> result =
+      aptinfo::AnalyzeProxyDllDirectory(GetFixturePath("proxydll"),
+                                        aNumThreads);
+  ASSERT(std::holds_alternative<std::vector<ProxyDllInfo>>(result));
+
+  // Directory order is unspecified. notpe.dll and wrap.dll are omitted since
+  // they have no valid tables, and ignored.txt is not a DLL at all.
+  std::vector<ProxyDllInfo> &dlls = std::get<std::vector<ProxyDllInfo>>(result);
+  std::sort(dlls.begin(), dlls.end(),
+            [](const ProxyDllInfo &aLeft, const ProxyDllInfo &aRight) {
+              return aLeft.mPath.filename() < aRight.mPath.filename();
+            });
+  ASSERT(dlls.size() == 2);
+  EXPECT(dlls[0].mPath.filename() == "ps32.dll");
+  EXPECT(dlls[1].mPath.filename() == "ps64.DLL");
+  for (const ProxyDllInfo &dll : dlls) {
+    ExpectFixtureInterfaces(dll);
+  }
+
+  aptinfo::ProxyDllIndex index(std::move(dlls));
+  EXPECT(index.GetNumDlls() == 2);
+
+  size_t numFooBar = 0;
+  index.Lookup(kIidFooBar, [&numFooBar](const ProxyDllInfo &,
+                                        const ProxiedInterface &aEntry) {
+    EXPECT(aEntry.mName == "IFooBar");
+    ++numFooBar;
+  });
+  EXPECT(numFooBar == 2);
+
+  size_t numDecoy = 0;
+  index.Lookup(kIidCodeDecoy,
+               [&numDecoy](const ProxyDllInfo &, const ProxiedInterface &) {
+                 ++numDecoy;
+               });
+  EXPECT(!numDecoy);
+}
+
+int main() {
+  TestSingleDll("proxydll/ps32.dll");
+  TestSingleDll("proxydll/ps64.DLL");
+  TestFailures();
+  TestDirectory(1);
+  TestDirectory(4);
+  return aptinfo::testing::gNumFailures;
+}
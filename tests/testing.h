@@ -0,0 +1,44 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// A deliberately tiny test harness for the portable parts of the library.
+// Each test executable returns the number of failed expectations.
+
+#pragma once
+
+#include <filesystem>
+
+#include <stdio.h>
+
+namespace aptinfo::testing {
+
+inline int gNumFailures = 0;
+
+inline std::filesystem::path GetFixturePath(const char *aRelativePath) {
+  return std::filesystem::path(APTINFO_FIXTURE_DIR) / aRelativePath;
+}
+
+} // namespace aptinfo::testing
+
+#define EXPECT(aCondition)                                                     \
+  do {                                                                         \
+    if (!(aCondition)) {                                                       \
+      fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__,              \
+              #aCondition);                                                    \
+      ++::aptinfo::testing::gNumFailures;                                      \
+    }                                                                          \
+  } while (0)
+
+// For preconditions that the remainder of a test depends upon.
+#define ASSERT(aCondition)                                                     \
+  do {                                                                         \
+    if (!(aCondition)) {                                                       \
+      fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__,              \
+              #aCondition);                                                    \
+      ++::aptinfo::testing::gNumFailures;                                      \
+      return;                                                                  \
+    }                                                                          \
+  } while (0)